@@ -13,7 +13,6 @@ using std::setw;
 
 // enum state
 enum State {won, lost, interim, draw};
-State st = interim;
 
 // AI struct
 struct AI {
@@ -22,45 +21,740 @@ struct AI {
 };
 
 // Node struct for Tree Search
-// root Node has NULL for parent
-// leaf node has NULL for children
+// nodes live in a NodePool and refer to each other by index
+// the children of a node are stored next to each other: [firstChild, firstChild + childCount)
+// root Node has NO_NODE for parent
+// leaf node has NO_NODE for firstChild (EXPANDING while another thread allocates its children)
+// the statistics are plain integers so that threads sharing a tree can update them atomically
+// a node whose game-theoretic value is known (MCTS-Solver) carries it as a Proof for the player who dropped into column;
+// its value is the playout points of that result plus one
+const uint32_t NO_NODE = 0xFFFFFFFF;
+const uint32_t EXPANDING = 0xFFFFFFFE;
+enum Proof {unproven, provenLoss, provenDraw, provenWin};
 struct Node {
-    int value = 0;  // heuristic value| won: value = 1; lost: value = -1; draw: value = 0;
-    int column;                   // column number
-    Node* parent = NULL;          // parent Node
-    std::vector<Node*> children;  // array of children Nodes
+    uint32_t score;       // playout points of the player who dropped into column| win: 2; draw: 1; loss: 0;
+    uint32_t visits;      // number of playouts through this node (including virtual losses in flight)
+    uint32_t amafScore;   // RAVE: points of player in the playouts through the parent that left a disc of player on cell
+    uint32_t amafVisits;  // RAVE: number of those playouts (all moves as first)
+    uint32_t parent;      // index of the parent Node
+    uint32_t firstChild;  // index of the first child Node
+    uint8_t childCount;   // number of children Nodes
+    uint8_t column;       // column number
+    uint8_t cell;         // bit index of the disc dropped into column
+    uint8_t player;       // player who dropped into column| 'o': player = 0; 'x': player = 1;
+    uint8_t proof;        // Proof of the position after the move, unproven until the solver settles it
 };
 
-std::vector<int> coords(2); // vector storing coordinates of location
+
+// parallelization of the Monte Carlo Tree Search engine
+// rootParallel: every thread builds its own tree, the root statistics are merged at the end
+// treeParallel: all threads share one tree, virtual losses spread them over different paths
+// the alpha-beta engine runs its threads on one transposition table (Lazy SMP) in either mode
+enum ParallelMode {sequential, rootParallel, treeParallel};
+
+// moves of the Monte Carlo Tree Search playouts
+// uniformRollouts: uniformly random columns
+// tacticalRollouts: a winning move if there is one, else a move onto the opponent's winning cell, else a random column
+enum RolloutPolicy {uniformRollouts, tacticalRollouts};
+
+// which entry of a full bucket storeTable overwrites, unless one holds the same position
+// replaceAlways: the slot picked by the key; the table behaves like one entry per slot, always replaced
+// replaceDepth: the shallowest entry; replaceVisits: the one with the fewest visits (the least work)
+// entries of earlier searches count as 8 plies (or 8 doublings of the visits) less per search they are old
+enum Replacement {replaceAlways, replaceDepth, replaceVisits};
+
+// parameters of the search engines
+struct SearchConfig {
+    double exploration = 1.41;         // UCB1 exploration constant (sqrt(2) for win rates in [0, 1])
+    unsigned long timeLimit = 2000;    // milliseconds per move, 0 for no limit
+    unsigned long nodeLimit = 0;       // playouts (MCTS) or nodes (alpha-beta) per move, 0 for no limit
+    unsigned long maxNodes = 2000000;  // capacity of each NodePool (see treeCapacity)
+    bool recycle = true;               // prune the least visited subtrees of a full tree (see pruneTree), else it stops growing
+    ParallelMode parallel = sequential;
+    bool reuseTree = true;             // carry the subtree of the reached position into the next search
+    bool ponder = false;               // search the human's replies in the background during the human's turn
+    int threads = 1;                   // number of search threads unless parallel is sequential
+    int virtualLoss = 3;               // visits added to a node while a treeParallel thread is below it
+    unsigned long tableMB = 64;        // size of the transposition table in megabytes
+    Replacement tableReplacement = replaceDepth;  // which table entries give way to new ones
+    int leafPlayouts = 1;              // random playouts from every selected leaf, played in lockstep when above 1
+    double raveEquivalence = 0;        // RAVE: visits at which the AMAF and UCT values weigh the same, 0 for no RAVE
+    RolloutPolicy rollout = uniformRollouts;  // moves of the MCTS playouts
+    bool verbose = true;               // print the search summary on the console (off for the engine protocol)
+};
+
+// record of the work done by one search, filled by every engine (see Engine::stats)
+// the engine protocol reports it in its info line, --stats writes it as one JSON object per line
+struct SearchStats {
+    unsigned long iterations = 0;  // playouts (MCTS) or finished deepening iterations (alpha-beta)
+    unsigned long nodes = 0;       // nodes added to the trees (MCTS) or searched nodes (alpha-beta)
+    unsigned long reused = 0;      // playouts kept from earlier searches and pondering (MCTS)
+    unsigned long pruned = 0;      // nodes freed by pruneTree to make room in full trees (MCTS)
+    double rate = 0;               // playouts (MCTS) or nodes (alpha-beta) per second of search time
+    int depth = 0;                 // deepest leaf (MCTS) or deepest finished iteration (alpha-beta)
+    double averageDepth = 0;       // mean depth of the playout leaves (MCTS)
+    unsigned long probes = 0;      // transposition table lookups (alpha-beta, and MCTS leaves before expansion)
+    unsigned long hits = 0;        // lookups that found the position
+    unsigned long memory = 0;      // peak bytes of the tree nodes in use during the search, or of the transposition table
+    int score = 0;                 // alpha-beta score, or MCTS win rate of the chosen column in per mille
+    double milliseconds = 0;       // the whole move decision
+    double prepareMs = 0;          // tree reuse and allocation, or transposition table allocation
+    double searchMs = 0;           // the search threads
+    double finishMs = 0;           // merging the trees and choosing the column
+    bool book = false;             // the move came from the opening book
+};
+
+// transposition table entry, as read by probeTable and written by storeTable
+// flag tells whether score is exact, a lower bound (fail high) or an upper bound (fail low)
+// the alpha-beta solver stores its search results; MCTS stores the positions its solver proved (see proveNode)
+enum Bound {exact, lower, upper};
+struct TTEntry {
+    uint64_t key;    // canonicalKey of the position
+    int16_t score;   // score from the side to move
+    uint8_t depth;   // remaining depth the score was searched to, 0 for an empty slot, 255 for a proven result
+    uint8_t flag;    // Bound of score
+    int8_t move;     // best column (from 0) in the canonical orientation, -1 for none
+    uint8_t generation; // search that wrote the entry, see TranspositionTable::generation
+    uint32_t visits; // nodes (alpha-beta) or playouts (MCTS) spent on the position, saturates at 2^27 - 1
+};
+
+// one slot of a TTBucket: data packs the fields of a TTEntry (see packEntry) and check is key ^ data
+// the slots are written and read as two independent words, without locks; a reader that gets the words
+// of two different writes sees a check that does not match, so a torn slot reads as an empty one
+struct TTSlot {
+    uint64_t check;
+    uint64_t data;
+};
+const int TT_SLOTS = 4;
+struct alignas(64) TTBucket {
+    TTSlot slots[TT_SLOTS];  // one cache line: a probe costs a single miss
+};
+
+// Zobrist-keyed transposition table shared by all threads of a search, lock-free (see TTSlot)
+// it is kept between moves so that later searches start with the earlier results
+struct TranspositionTable {
+    std::vector<uint8_t> memory;   // the buckets, from the first cache line boundary on (see tableBuckets)
+    size_t offset = 0;             // bytes before that boundary
+    uint64_t mask = 0;             // number of buckets - 1, a power of two
+    uint8_t generation = 0;        // counts the searches (modulo 64 as the age of the entries), see newSearch
+    Replacement replacement = replaceDepth;  // set by resizeTable
+};
+
+// stop condition of one search, shared by all of its threads
+// the search ends at the deadline or when the node budget is used up, whichever comes first
+struct Budget {
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point deadline;
+    bool timed = false;                 // false: no deadline
+    unsigned long nodeLimit = 0;        // 0: no node budget
+    std::atomic<unsigned long> nodes{0};// nodes (playouts) handed out so far
+    std::atomic<bool> stopped{false};
+};
+
+// state of one alpha-beta search
+struct Solver {
+    TranspositionTable* table;   // shared with the other threads of the search
+    Budget* budget;
+    int rootMoves = 0;           // discs on the board at the root
+    int bestMove = -1;           // best column (from 0) at the root of the last search that was not stopped
+    unsigned long nodes = 0;
+    unsigned long probes = 0;  // transposition table lookups
+    unsigned long hits = 0;    // lookups that found the position
+    bool stopped = false;   // the budget ran out, the current iteration is discarded
+};
+
+// scores of the alpha-beta solver
+// a win is worth MATE minus the number of discs on the board after the winning move,
+// so faster wins score higher and a score never depends on the root of the search
+const int MATE = 1000;
+
+// board geometry shared by every Position of a game
+// bit index of a cell = column*rows + row, row 0 is the bottom row
+// boards up to 64 cells (e.g. 6x7, 7x9) fit in one 64-bit mask per player
+const int MAX_COLUMNS = 16;
+const int MAX_CELLS = 64;
+const int ROLLOUT_LANES = 8;  // boards advanced together by rolloutBatch, a multiple of 4 (one AVX2 register)
+struct Position;
+struct Rng;
+struct Playouts;
+struct Shape {
+    int rows;
+    int columns;
+    int connect;           // number of discs in a row that wins (usually 4)
+    int shift[4];          // bit distance along the vertical, horizontal, rising and falling diagonal
+    uint64_t winStart[4];  // cells from which connect in a row along shift[d] stays on the board
+    uint8_t reach[MAX_CELLS][4][2]; // steps from a cell to the edge along shift[d], forwards and backwards
+    int order[MAX_COLUMNS];// columns (from 0) ordered from the center outwards
+    int mirror;            // bit index of the bottom cell of the last column, (columns-1)*rows
+    uint32_t leftHalf;     // columns (from 0) up to the middle one, the moves kept from a symmetric position
+    // kernels compiled for this geometry, or for any geometry (see initShape)
+    State (*checkKernel)(const Position& pos, int choice);
+    uint64_t (*winningCellsKernel)(const Position& pos, int choice);
+    int (*rolloutKernel)(Position& pos, int player, Rng& rng, bool tactical);
+    void (*rolloutBatchKernel)(const Position& pos, int player, Rng& rng, int count, Playouts& playouts, bool tactical);
+};
+
+// bitboard position used by the search engines
+// the vector grid is only kept for printGrid and the interactive I/O
+struct Position {
+    const Shape* shape;
+    uint64_t stones[2];            // stones[0]: 'o' discs; stones[1]: 'x' discs
+    uint8_t height[MAX_COLUMNS];   // number of discs in each column
+    uint64_t key;                  // Zobrist key, updated by drop and undo
+    uint64_t mirrorKey;            // Zobrist key of the mirror image (columns reversed), updated with key
+    uint32_t legal;                // bit c is set while column c (from 0) has space
+    int moves;                     // number of discs on the board; x moves when it is even
+};
+
+uint64_t zobrist[2][MAX_CELLS]; // random key of each disc, filled once by initZobrist
+
+// results of the playouts of one Monte Carlo Tree Search iteration (see mcts and backPropagate)
+// the AMAF tallies are only kept (and cleared by mcts) for RAVE
+// with a transposition table, the keys of the path let backPropagate store the positions it proves
+struct Playouts {
+    uint32_t wins[2] = {0, 0};  // wins[0]: 'o' won; wins[1]: 'x' won
+    uint32_t draws = 0;
+    bool amaf = false;                   // fill amafVisits and amafPoints (see addAmaf)
+    uint32_t amafVisits[2][MAX_CELLS];   // playouts that ended with a disc of the player on the cell
+    uint32_t amafPoints[2][MAX_CELLS];   // points of the player in those playouts| win: 2; draw: 1; loss: 0;
+    TranspositionTable* table = nullptr; // proofs shared with other paths, threads and searches, set by searchTree
+    uint64_t keys[MAX_CELLS + 1];        // canonicalKey of every position on the path, the root first
+    int length = 0;                      // depth of the selected node
+    unsigned long probes = 0;            // table lookups of all iterations so far
+    unsigned long hits = 0;
+};
+
+// xoshiro256** pseudorandom number generator
+// every search owns its generator, so threads never share random state
+// the same seed reproduces the same game
+struct Rng {
+    uint64_t s[4];
+};
+
+// board geometry of the kernels (drop, check, winningCells, rollout), read from the Shape of the position
+// it works for every board size
+struct RuntimeGeometry {
+    static int rows(const Position& pos) {return pos.shape->rows;}
+    static int columns(const Position& pos) {return pos.shape->columns;}
+    static int connect(const Position& pos) {return pos.shape->connect;}
+    static int mirror(const Position& pos) {return pos.shape->mirror;}
+    static int shift(const Position& pos, int d) {return pos.shape->shift[d];}
+    static uint64_t winStart(const Position& pos, int d) {return pos.shape->winStart[d];}
+};
+
+// board geometry of the kernels fixed at compile time for the common board sizes (see initShape)
+// the shifts and masks are constants, so the loops over the directions and run lengths unroll
+template <int ROWS, int COLUMNS, int CONNECT>
+struct FixedGeometry {
+    static_assert(ROWS * COLUMNS <= MAX_CELLS && COLUMNS <= MAX_COLUMNS, "the board has to fit in 64 bits");
+    static constexpr uint64_t startMask(int dr, int dc) {
+        uint64_t mask = 0;
+        for (int c = 0; c < COLUMNS; c++) {
+            for (int r = 0; r < ROWS; r++) {
+                int rEnd = r + (CONNECT-1)*dr;
+                if (rEnd >= 0 && rEnd < ROWS && c + (CONNECT-1)*dc < COLUMNS) mask |= 1ULL << (c*ROWS + r);
+            }
+        }
+        return mask;
+    }
+    static constexpr int SHIFT[4] = {1, ROWS, ROWS + 1, ROWS - 1};
+    static constexpr uint64_t START[4] = {startMask(1, 0), startMask(0, 1), startMask(1, 1), startMask(-1, 1)};
+    static int rows(const Position&) {return ROWS;}
+    static int columns(const Position&) {return COLUMNS;}
+    static int connect(const Position&) {return CONNECT;}
+    static int mirror(const Position&) {return (COLUMNS-1)*ROWS;}
+    static int shift(const Position&, int d) {return SHIFT[d];}
+    static uint64_t winStart(const Position&, int d) {return START[d];}
+};
+template <int ROWS, int COLUMNS, int CONNECT> constexpr int FixedGeometry<ROWS, COLUMNS, CONNECT>::SHIFT[4];
+template <int ROWS, int COLUMNS, int CONNECT> constexpr uint64_t FixedGeometry<ROWS, COLUMNS, CONNECT>::START[4];
+
+// contiguous arena of Nodes for one search tree
+// the storage is allocated once and reused by every search; tearing a tree down is a single reset
+struct NodePool {
+    std::vector<Node> nodes;  // storage, never reallocated while a tree is being built
+    uint32_t size = 0;        // number of Nodes in use
+    uint32_t peak = 0;        // most Nodes in use since MonteCarloTreeSearch reset it (pruneTree lowers size)
+    Position root;            // position of the root Node (valid while size > 0)
+    int rows = 0;             // board of the tree; root.shape may belong to a closed session or be reused for
+    int columns = 0;          // another board, so reuseTree compares these instead
+    int connect = 0;
+    std::vector<uint32_t> relocation;  // new index of every node during pruneTree, allocated by the first one
+};
+
+// Monte Carlo Tree Search engine state kept from one move to the next
+// the subtree of the position actually reached is carried into the next search,
+// and a pondering thread keeps growing the tree while the human is thinking
+struct MCTSState {
+    std::vector<NodePool> pools = std::vector<NodePool>(1); // one tree per thread for rootParallel, pools[0] otherwise
+    std::thread ponder;             // background search on pools[0] during the human's turn
+    std::atomic<bool> stop{false};  // tells the pondering thread to return
+    ~MCTSState() {
+        stop = true;
+        if (ponder.joinable()) ponder.join();
+    }
+};
+
+// opening book file: a BookHeader followed by count BookEntries sorted by key
+// the entries are read in place from a memory map, so the layout is fixed and has no padding
+struct BookHeader {
+    char magic[4];       // "C4BK"
+    uint8_t rows;
+    uint8_t columns;
+    uint8_t connect;
+    uint8_t plies;       // positions with fewer discs than plies are in the book
+    uint32_t count;      // number of entries
+    uint32_t reserved;   // keeps the entries 8-byte aligned
+};
+struct BookEntry {
+    uint64_t key;        // canonicalKey of the position
+    int16_t score;       // alpha-beta score from the side to move
+    uint8_t move;        // best column (from 0) in the canonical orientation
+    uint8_t depth;       // depth of the search that chose the move
+    uint32_t reserved;
+};
+
+// opening book mapped into memory by loadBook
+struct OpeningBook {
+    const BookHeader* header = nullptr;
+    const BookEntry* entries = nullptr;
+    void* map = nullptr;   // the whole file
+    size_t length = 0;
+};
+
+// search engines a computer player can use, named on the command line and in the engine protocol
+enum EngineType {randomEngine, bruteForceEngine, mctsEngine, alphaBetaEngine};
+const int ENGINE_TYPES = 4;
+const char* engineNames[ENGINE_TYPES] = {"random", "bruteforce", "mcts", "alphabeta"};
+
+// a computer player: the selected engine with everything it keeps from one move to the next
+struct Engine {
+    EngineType type = mctsEngine;
+    SearchConfig config;
+    Rng rng;
+    MCTSState mcts;
+    TranspositionTable table;  // allocated by the first alpha-beta search
+    SearchStats stats;         // statistics of the last search
+    std::ostream* statsLog = nullptr;  // receives stats as a JSON line after every search when set
+    const OpeningBook* book = nullptr; // answers the book positions of the MCTS and alpha-beta engines when set
+};
+
+// settings of a self-play match between two engines
+// both engines search with config; they swap colors after every game
+// game g is played from seeds derived from (seed, g) only, so a node budget reproduces the match
+// on any number of jobs
+struct MatchConfig {
+    EngineType engines[2] = {mctsEngine, bruteForceEngine};
+    SearchConfig config;
+    int rows = 6;
+    int columns = 7;
+    int connect = 4;
+    int games = 100;
+    int jobs = 1;        // games played at the same time, one thread each
+    uint64_t seed = 0;
+};
+
+// state of one game driven by the engine protocol (see protocolCommand)
+// engineProtocol keeps one for its input, serveSessions one per session; pos refers to shape, so it stays in place
+struct ProtocolSession {
+    Shape shape;
+    std::vector<std::vector<int> > grid;  // empty grid of shape
+    Position pos;
+    bool over = false;          // the last move of pos won the game
+    Engine* engine = nullptr;
+    OpeningBook book;           // loaded by setoption book, replaces the book of the engine
+    std::chrono::steady_clock::time_point received;  // arrival of the command; the time budget of go counts from it
+};
+
+// fixed set of worker threads with one task deque each (see startPool)
+// a worker runs its own newest task first and steals the oldest task of another worker when its deque is empty
+// a task receives the index of the worker that runs it
+struct WorkerPool {
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void(int)> > tasks;
+    };
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::vector<std::thread> threads;
+    std::mutex mutex;                  // guards pending and stopping, the sleeping workers wait on it
+    std::condition_variable wake;
+    int pending = 0;                   // tasks in the deques
+    bool stopping = false;             // the workers return once the deques are empty
+    std::atomic<unsigned> next{0};     // deque of the next task submitted from outside the pool
+};
+
+// client of serveSessions; the replies are written whole under mutex
+struct Connection {
+    int fd;
+    std::mutex mutex;
+    bool open = true;            // false once the server has closed fd
+    std::string input;           // bytes received after the last complete line
+    std::vector<int> sessions;   // sessions opened by this client, closed when it disconnects
+};
+
+// protocol command waiting for its session
+struct SessionCommand {
+    std::string line;
+    std::shared_ptr<Connection> client;  // receives the replies, none for the quit of a disconnected client
+    std::chrono::steady_clock::time_point received;
+};
+
+// game hosted by serveSessions: a protocol session with its own engine
+// the commands of a session run one at a time in their order of arrival; the others wait in queue
+struct Session {
+    int id;
+    Engine engine;
+    ProtocolSession protocol;
+    std::mutex mutex;                  // guards queue, running and closed
+    std::deque<SessionCommand> queue;
+    bool running = false;              // a task of the session is in the pool
+    bool closed = false;               // quit has run, later commands are dropped
+};
+
+// search memory of a pool worker, lent to the engine of the session it searches for
+// a session keeps no tree or table between its requests, so thousands of sessions cost little memory
+struct WorkerMemory {
+    std::vector<NodePool> pools = std::vector<NodePool>(1);
+    TranspositionTable table;
+    int rows = 0;         // board of the trees and of the entries in table
+    int columns = 0;
+    int connect = 0;
+    unsigned long tableMB = 0;  // size of table requested by the session that allocated it
+};
+
+// engine host of serveSessions: the sessions by id and the pool that runs their commands
+struct SessionServer {
+    SearchConfig config;                   // initial settings of every session
+    const OpeningBook* book = nullptr;     // initial book of every session
+    uint64_t seed = 0;                     // session id is seeded with seed + id
+    WorkerPool pool;
+    std::vector<WorkerMemory> memory;      // one per worker
+    std::mutex mutex;                      // guards sessions and nextId
+    std::map<int, std::shared_ptr<Session> > sessions;
+    int nextId = 1;
+};
 
 // function declarations
+bool             checkBoard(int rows, int columns, int connect);
 void             printGrid(std::vector<std::vector<int> >& grid);
 std::vector<int> drop(std::vector<std::vector<int> >& grid, int choice, int col);
-State            check(std::vector<std::vector<int> >& grid, int row, int col);
-void             twoPlayerMode(std::vector<std::vector<int> >& grid);
-void             computerMode(std::vector<std::vector<int> >& grid, std::function<int(std::vector<std::vector<int> >&)> computer);
-int              randomizer(std::vector<std::vector<int> >& grid);
-int              bruteForce(std::vector<std::vector<int> >& grid);
-int              MonteCarloTreeSearch(std::vector<std::vector<int> >& grid1);
-void             destroyTree(Node* n); //
-Node*            addNode(Node* parent, int col); //
-Node*            mcts(std::vector<std::vector<int> >& grid, Node* root); //
-void             backPropagate(Node* leaf, int leafvalue); //
-std::vector<int> determineComputerChoice(std::vector<std::vector<int> >& grid);
+void             initZobrist();
+void             initShape(Shape& shape, int rows, int columns, int connect);
+Position         toPosition(const Shape& shape, std::vector<std::vector<int> >& grid);
+bool             canDrop(const Position& pos, int col);
+int              sideToMove(const Position& pos);
+int              randomLegal(const Position& pos, Rng& rng);
+int              drop(Position& pos, int choice, int col);
+void             undo(Position& pos, int choice, int col);
+State            check(const Position& pos, int choice);
+State            check(const Position& pos, int choice, int bit);
+uint64_t         winningCells(const Position& pos, int choice);
+bool             isFull(const Position& pos);
+uint64_t         canonicalKey(const Position& pos);
+int              canonicalColumn(const Position& pos, int col);
+void             twoPlayerMode(std::vector<std::vector<int> >& grid, int connect);
+void             computerMode(std::vector<std::vector<int> >& grid, int connect, std::function<int(Position&)> computer);
+void             seedRng(Rng& rng, uint64_t seed);
+uint64_t         nextRandom(Rng& rng);
+uint32_t         randomBelow(Rng& rng, uint32_t n);
+int              randomizer(Position& pos, Rng& rng);
+int              bruteForce(Position& pos, Rng& rng);
+int              engineMove(Engine& engine, Position& pos);
+void             writeStats(std::ostream& out, const SearchStats& stats, EngineType type);
+void             clearEngine(Engine& engine);
+int              columnOf(char c);
+char             columnName(int column);
+int              engineOf(const std::string& name);
+int              playMoves(Position& pos, const std::string& moves, bool& over);
+uint64_t         perft(Position& pos, int player, int depth, bool terminal);
+uint64_t         expandLevel(std::vector<Position>& level, bool terminal);
+std::vector<uint64_t> perftUnique(const Position& pos, int depth, bool terminal);
+void             perftReport(const Position& pos, int depth, bool unique, bool terminal);
+int              playGame(const Shape& shape, Engine* players[2]);
+double           eloDifference(double score);
+bool             loadBook(OpeningBook& book, const char* path);
+void             closeBook(OpeningBook& book);
+int              probeBook(const OpeningBook& book, const Position& pos);
+bool             makeBook(const char* path, const Shape& shape, int plies, const SearchConfig& config, int jobs);
+double           timeOperation(const std::function<void(unsigned long)>& body, unsigned long& operations);
+void             benchmark(int rows, int columns, int connect, const SearchConfig& config, uint64_t seed);
+void             selfPlay(const MatchConfig& match);
+void             engineProtocol(std::istream& in, std::ostream& out, Engine& engine);
+void             openSession(ProtocolSession& session, Engine& engine);
+void             closeSession(ProtocolSession& session);
+bool             protocolCommand(ProtocolSession& session, const std::string& line, std::ostream& out);
+void             startPool(WorkerPool& pool, int threads);
+void             submitTask(WorkerPool& pool, const std::function<void(int)>& task, int worker);
+void             runWorker(WorkerPool& pool, int worker);
+void             stopPool(WorkerPool& pool);
+int              listenOn(const std::string& address);
+void             sendReply(Connection& client, const std::string& text);
+bool             serverRequest(SessionServer& server, const std::shared_ptr<Connection>& client, const std::string& line);
+void             queueCommand(SessionServer& server, const std::shared_ptr<Session>& session, const SessionCommand& command);
+void             runSession(SessionServer& server, const std::shared_ptr<Session>& session, int worker);
+bool             serveSessions(const std::string& address, const SearchConfig& config, int workers, uint64_t seed, const OpeningBook* book);
+int              MonteCarloTreeSearch(Position& pos, const SearchConfig& config, MCTSState& state, TranspositionTable* table, Rng& rng, SearchStats& stats);
+void             startBudget(Budget& budget, const SearchConfig& config);
+unsigned long    claimNodes(Budget& budget, unsigned long count);
+void             searchTree(Position& pos, NodePool& pool, uint32_t root, const SearchConfig& config, TranspositionTable* table, Budget& budget, bool shared, uint64_t seed, SearchStats& stats);
+void             ponderTree(MCTSState& state, const SearchConfig& config, uint64_t seed);
+void             stopPondering(MCTSState& state);
+uint32_t         createTree(NodePool& pool, unsigned long capacity, const Position& pos);
+bool             reuseTree(NodePool& pool, const Position& pos);
+void             destroyTree(NodePool& pool);
+unsigned long    pruneTree(NodePool& pool);
+unsigned long    treeCapacity(unsigned long megabytes);
+bool             addNodes(NodePool& pool, uint32_t parent, const Position& pos, bool shared);
+bool             proveNode(NodePool& pool, uint32_t node, bool shared);
+int              entryProof(const TTEntry& entry, const Position& pos);
+void             storeProof(TranspositionTable& table, uint64_t key, int proof, const Position& root, unsigned long visits);
+uint32_t         mcts(Position& pos, NodePool& pool, uint32_t root, const SearchConfig& config, int count, Playouts& playouts, bool shared, Rng& rng);
+int              rollout(Position& pos, int player, Rng& rng, bool tactical);
+void             rolloutBatch(const Position& pos, int player, Rng& rng, int count, Playouts& playouts, bool tactical);
+void             addAmaf(Playouts& playouts, uint64_t o, uint64_t x, int winner, uint32_t count);
+int              backPropagate(NodePool& pool, uint32_t leaf, const Playouts& playouts, int virtualLoss);
+int              alphaBeta(Position& pos, const SearchConfig& config, TranspositionTable& table, SearchStats& stats);
+int              negamax(Solver& solver, Position& pos, int player, int depth, int alpha, int beta);
+void             lazySearch(Solver& solver, const Position& root, int helper);
+int              evaluate(const Position& pos, int player);
+void             resizeTable(TranspositionTable& table, unsigned long megabytes, Replacement replacement);
+void             newSearch(TranspositionTable& table);
+bool             probeTable(TranspositionTable& table, uint64_t key, TTEntry& entry);
+void             storeTable(TranspositionTable& table, uint64_t key, int score, int depth, int flag, int move, unsigned long visits);
+uint64_t         packEntry(int score, int depth, int flag, int move, int generation, unsigned long visits);
+TTBucket*        tableBuckets(TranspositionTable& table);
+std::vector<int> determineComputerChoice(const Position& pos);
 
+// kernels for one board geometry (RuntimeGeometry or FixedGeometry)
+template <class Geometry> void     useGeometry(Shape& shape);
+template <class Geometry> int      randomLegalWith(const Position& pos, Rng& rng);
+template <class Geometry> int      dropWith(Position& pos, int choice, int col);
+template <class Geometry> State    checkWith(const Position& pos, int choice);
+template <class Geometry> uint64_t winningCellsWith(const Position& pos, int choice);
+template <class Geometry> uint64_t winningCellsOf(const Position& pos, uint64_t discs);
+template <class Geometry> int      rolloutWith(Position& pos, int player, Rng& rng, bool tactical);
+template <class Geometry> int      tacticalRolloutWith(Position& pos, int player, Rng& rng);
+template <class Geometry> void     rolloutBatchWith(const Position& pos, int player, Rng& rng, int count, Playouts& playouts, bool tactical);
+template <class Geometry> void     checkLanes(const Position& pos, const uint64_t* discs, uint64_t* wins);
 
 
-int main() {
-    srand(time(NULL)); // initialize pseudorandom seed
+
+// usage: Connect4 [--seed n] [--time ms] [--nodes n] [--engine] [--stats file]
+//        Connect4 --match a,b [--games n] [--jobs n] [--rows n] [--columns n] [--connect n] [--seed n] [--time ms] [--nodes n]
+//        Connect4 --bench [--rows n --columns n --connect n] [--seed n] [--time ms] [--nodes n]
+//        Connect4 --make-book file [--plies n] [--jobs n] [--rows n] [--columns n] [--connect n] [--time ms] [--nodes n]
+//        Connect4 --perft depth [--unique] [--no-terminal] [--moves columns] [--rows n] [--columns n] [--connect n]
+//        Connect4 --serve port|path [--jobs n] [--seed n] [--time ms] [--nodes n] [--book file]
+// the same seed replays the same computer moves (with a node budget instead of a time budget)
+// --time and --nodes set the budget of the search engines per move, 0 for no limit
+// --tree-mb caps each MCTS tree at the given megabytes; a full tree drops its least visited subtrees (see pruneTree)
+// --leaf-playouts n makes every MCTS iteration play n random playouts from its leaf, in lockstep (default 1)
+// --rave k blends AMAF statistics into the MCTS selection, with equal weight at k visits (default 0: no RAVE)
+// --rollout tactical makes the MCTS playouts take wins and block the opponent's (default uniform: random columns)
+// --hash sets the megabytes of the transposition table shared by the MCTS and alpha-beta threads (default 64), and
+// --hash-replace always|depth|visits which of its entries give way (default depth, see Replacement)
+// --engine reads protocol commands from stdin instead of playing an interactive game (see engineProtocol)
+// --stats appends the SearchStats of every computer move to file, one JSON object per line
+// --book lets the engines answer the positions of an opening book file (see loadBook)
+// --make-book writes the alpha-beta moves of all positions with fewer than plies (default 4) discs to file
+//             (see makeBook); each search gets 1000000 nodes unless --time or --nodes is given
+// --match plays a self-play match between two engines named in engineNames (see selfPlay)
+// --bench measures the primitives of the engines (see benchmark) on the given board, or on 4x5, 6x7, 7x9 and 8x8
+//         boards by default; the MCTS decisions get 100000 playouts unless --time or --nodes is given
+// --perft counts the move sequences (--unique: the distinct positions) up to depth moves after --moves
+//         (see perftReport); --no-terminal leaves out the won and full positions
+// --serve hosts engine protocol sessions for clients of a local TCP port or Unix socket path (see serveSessions),
+//         searching on --jobs worker threads (default: one per core)
+int main(int argc, char* argv[]) {
+    uint64_t seed = time(NULL);
+    bool protocol = false;
+    bool bench = false;
+    bool budget = false;  // --time or --nodes was given
+    bool board = false;   // --rows, --columns or --connect was given
+    int perftDepth = 0;
+    bool unique = false;
+    bool terminal = true;
+    std::string moves;
+    std::ofstream statsFile;
+    OpeningBook book;
+    std::string bookFile;
+    int plies = 4;
+    std::string matchEngines;
+    std::string serveAddress;
+    MatchConfig match;
+    match.jobs = std::max(1u, std::thread::hardware_concurrency());
+    Engine engine;
+    SearchConfig& config = engine.config;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--engine") == 0) protocol = true;
+        if (strcmp(argv[i], "--bench") == 0) bench = true;
+        if (strcmp(argv[i], "--unique") == 0) unique = true;
+        if (strcmp(argv[i], "--no-terminal") == 0) terminal = false;
+        if (i + 1 == argc) break;
+        if (strcmp(argv[i], "--seed") == 0) seed = strtoull(argv[i+1], NULL, 10);
+        if (strcmp(argv[i], "--time") == 0) config.timeLimit = strtoul(argv[i+1], NULL, 10), budget = true;
+        if (strcmp(argv[i], "--nodes") == 0) config.nodeLimit = strtoul(argv[i+1], NULL, 10), budget = true;
+        if (strcmp(argv[i], "--tree-mb") == 0) config.maxNodes = std::max((unsigned long) MAX_COLUMNS + 1, treeCapacity(strtoul(argv[i+1], NULL, 10)));
+        if (strcmp(argv[i], "--leaf-playouts") == 0) config.leafPlayouts = std::max(1, atoi(argv[i+1]));
+        if (strcmp(argv[i], "--rave") == 0) config.raveEquivalence = std::max(0.0, atof(argv[i+1]));
+        if (strcmp(argv[i], "--rollout") == 0) config.rollout = (strcmp(argv[i+1], "tactical") == 0) ? tacticalRollouts : uniformRollouts;
+        if (strcmp(argv[i], "--hash") == 0) config.tableMB = strtoul(argv[i+1], NULL, 10);
+        if (strcmp(argv[i], "--hash-replace") == 0) {
+            config.tableReplacement = (strcmp(argv[i+1], "always") == 0) ? replaceAlways :
+                                      (strcmp(argv[i+1], "visits") == 0) ? replaceVisits : replaceDepth;
+        }
+        if (strcmp(argv[i], "--match") == 0) matchEngines = argv[i+1];
+        if (strcmp(argv[i], "--perft") == 0) perftDepth = atoi(argv[i+1]);
+        if (strcmp(argv[i], "--moves") == 0) moves = argv[i+1];
+        if (strcmp(argv[i], "--plies") == 0) plies = atoi(argv[i+1]);
+        if (strcmp(argv[i], "--make-book") == 0) bookFile = argv[i+1];
+        if (strcmp(argv[i], "--serve") == 0) serveAddress = argv[i+1];
+        if (strcmp(argv[i], "--book") == 0) {
+            if (!loadBook(book, argv[i+1])) {
+                cout << "Warning. " << argv[i+1] << " is not an opening book." << endl;
+                return 1;
+            }
+            engine.book = &book;
+        }
+        if (strcmp(argv[i], "--stats") == 0) {
+            statsFile.open(argv[i+1], std::ios::app);
+            engine.statsLog = &statsFile;
+        }
+        if (strcmp(argv[i], "--games") == 0) match.games = atoi(argv[i+1]);
+        if (strcmp(argv[i], "--jobs") == 0) match.jobs = atoi(argv[i+1]);
+        if (strcmp(argv[i], "--rows") == 0) match.rows = atoi(argv[i+1]), board = true;
+        if (strcmp(argv[i], "--columns") == 0) match.columns = atoi(argv[i+1]), board = true;
+        if (strcmp(argv[i], "--connect") == 0) match.connect = atoi(argv[i+1]), board = true;
+    }
+    if (!bookFile.empty() && !budget) {
+        config.timeLimit = 0;
+        config.nodeLimit = 1000000;
+    }
+    if (bench && !budget) {
+        config.timeLimit = 0;
+        config.nodeLimit = 100000;
+    }
+    if (config.timeLimit == 0 && config.nodeLimit == 0) {
+        config.timeLimit = 2000;
+        if (!protocol && !bench && perftDepth == 0 && bookFile.empty() && serveAddress.empty()) cout << "Warning. Without a time or node budget the search would not stop; using 2000 ms." << endl;
+    }
+    seedRng(engine.rng, seed); // initialize pseudorandom seed
+    initZobrist();
+    if (protocol) {
+        config.verbose = false;
+        engineProtocol(cin, cout, engine);
+        return 0;
+    }
+    if (!serveAddress.empty()) {
+        if (match.jobs < 1) {
+            cout << "Warning. --jobs needs at least 1 worker." << endl;
+            return 1;
+        }
+        config.verbose = false;
+        config.ponder = false;
+        cout << "Serving sessions on " << serveAddress << " with " << match.jobs << " workers." << endl;
+        if (!serveSessions(serveAddress, config, match.jobs, seed, engine.book)) {
+            cout << "Warning. " << serveAddress << " could not be opened." << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (!bookFile.empty()) {
+        if (!checkBoard(match.rows, match.columns, match.connect)) return 1;
+        if (plies < 1 || plies > 255) {
+            cout << "Warning. --plies needs 1 to 255 discs." << endl;
+            return 1;
+        }
+        if (match.jobs < 1) {
+            cout << "Warning. --jobs needs at least 1 worker." << endl;
+            return 1;
+        }
+        Shape shape;
+        initShape(shape, match.rows, match.columns, match.connect);
+        if (!makeBook(bookFile.c_str(), shape, plies, config, match.jobs)) {
+            cout << "Warning. " << bookFile << " could not be written." << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (perftDepth > 0) {
+        if (!checkBoard(match.rows, match.columns, match.connect)) return 1;
+        Shape shape;
+        initShape(shape, match.rows, match.columns, match.connect);
+        std::vector<std::vector<int> > empty(match.rows, std::vector<int>(match.columns, 2));
+        Position pos = toPosition(shape, empty);
+        bool over = false;
+        int illegal = playMoves(pos, moves, over);
+        if (illegal > 0 || over) {
+            cout << "Warning. Move " << (illegal > 0 ? illegal : (int) moves.size()) << " of --moves ends the game or is not legal." << endl;
+            return 1;
+        }
+        perftReport(pos, perftDepth, unique, terminal);
+        return 0;
+    }
+    if (bench) {
+        int boards[4][3] = {{4, 5, 3}, {6, 7, 4}, {7, 9, 4}, {8, 8, 5}};
+        if (board) {
+            if (!checkBoard(match.rows, match.columns, match.connect)) return 1;
+            benchmark(match.rows, match.columns, match.connect, config, seed);
+        } else {
+            for (int b = 0; b < 4; b++) {
+                benchmark(boards[b][0], boards[b][1], boards[b][2], config, seed);
+            }
+        }
+        return 0;
+    }
+    if (!matchEngines.empty()) {
+        size_t comma = matchEngines.find(',');
+        int a = engineOf(matchEngines.substr(0, comma));
+        int b = (comma == std::string::npos) ? -1 : engineOf(matchEngines.substr(comma + 1));
+        if (a < 0 || b < 0) {
+            cout << "Warning. --match needs two of random, bruteforce, mcts and alphabeta, e.g. --match mcts,bruteforce." << endl;
+            return 1;
+        }
+        if (!checkBoard(match.rows, match.columns, match.connect)) return 1;
+        if (match.games < 1) {
+            cout << "Warning. --games needs at least 1 game." << endl;
+            return 1;
+        }
+        if (match.jobs < 1) {
+            cout << "Warning. --jobs needs at least 1 worker." << endl;
+            return 1;
+        }
+        match.engines[0] = (EngineType) a;
+        match.engines[1] = (EngineType) b;
+        match.config = config;
+        match.config.verbose = false;
+        match.seed = seed;
+        cout << "Random seed: " << seed << endl;
+        selfPlay(match);
+        return 0;
+    }
+    cout << "Random seed: " << seed << endl;
     
     // user defined board grid
     int rows, columns;
-    cout << "Please enter the number of rows for the board (usually 6): ";
-    cin >> rows;
-    cin.ignore();
-    cout << "Please enter the number of columns for the board (usually 7): ";
-    cin >> columns;
-    cin.ignore();
+    bool size = true;
+    while (size) {
+        cout << "Please enter the number of rows for the board (usually 6): ";
+        cin >> rows;
+        cin.ignore();
+        cout << "Please enter the number of columns for the board (usually 7): ";
+        cin >> columns;
+        cin.ignore(); size = false;
+        // the search engines keep one bit per cell in a 64-bit mask
+        if (rows < 1 || columns < 1 || columns > MAX_COLUMNS || rows*columns > MAX_CELLS) {
+            cout << "Warning. The board can have at most " << MAX_CELLS << " cells and " << MAX_COLUMNS << " columns." << endl;
+            size = true;
+        }
+    }
+    
+    int connect = 0;
+    while (connect < 2) {
+        cout << "Please enter the number of discs in a row needed to win (usually 4): ";
+        cin >> connect;
+        cin.ignore();
+    }
     
     // initialize the grid with blanks
     // blanks = 2; 'o' = 0; 'x' = 1;
@@ -79,27 +773,62 @@ int main() {
     cout << "Enter 1 for Randomizer Mode" << endl;
     cout << "Enter 2 for Brute Force Mode" << endl;
     cout << "Enter 3 for Monte Carlo Tree Search Mode" << endl;
-    cout << "Enter 4 for Two-Player Mode: ";
+    cout << "Enter 4 for Two-Player Mode" << endl;
+    cout << "Enter 5 for Parallel Monte Carlo Tree Search Mode (one tree per thread)" << endl;
+    cout << "Enter 6 for Parallel Monte Carlo Tree Search Mode (shared tree)" << endl;
+    cout << "Enter 7 for Alpha-Beta Solver Mode: ";
     cin >> choice;
     cin.ignore();
+    if (choice == 3 || choice == 5 || choice == 6) {
+        cout << "Enter 1 to let the computer think during your turn, 0 otherwise: ";
+        cin >> config.ponder;
+        cin.ignore();
+    }
+    if (choice == 5 || choice == 6) {
+        config.parallel = (choice == 5) ? rootParallel : treeParallel;
+        config.threads = 0;
+        while (config.threads < 1) {
+            cout << "Please enter the number of search threads (this machine has " << std::thread::hardware_concurrency() << "): ";
+            cin >> config.threads;
+            cin.ignore();
+        }
+    }
     switch(choice) {
         case 1 :
-            computerMode(grid, randomizer);
+            engine.type = randomEngine;
             break;
         case 2 :
-            computerMode(grid, bruteForce);
+            engine.type = bruteForceEngine;
             break;
         case 3 :
-            computerMode(grid, MonteCarloTreeSearch);
+        case 5 :
+        case 6 :
+            engine.type = mctsEngine;
             break;
-        case 4 :
-            twoPlayerMode(grid);
+        case 7 :
+            engine.type = alphaBetaEngine;
             break;
     }
+    if (choice == 4) {
+        twoPlayerMode(grid, connect);
+    } else if (choice >= 1 && choice <= 7) {
+        computerMode(grid, connect, [&engine](Position& pos) {return engineMove(engine, pos);});
+    }
     
     return 0;
 }
 
+// this function checks the --rows, --columns and --connect of the command line
+// returns true if the board fits the bitboards, else prints a warning and returns false
+bool checkBoard(int rows, int columns, int connect) {
+    if (rows < 1 || columns < 1 || columns > MAX_COLUMNS || rows*columns > MAX_CELLS || connect < 2) {
+        cout << "Warning. The board can have at most " << MAX_CELLS << " cells and " << MAX_COLUMNS
+             << " columns, and needs at least 2 discs in a row." << endl;
+        return false;
+    }
+    return true;
+}
+
 // this function displays the current grid on the terminal
 void printGrid(std::vector<std::vector<int> >& grid) {
     int columns = grid[0].size();
@@ -195,86 +924,354 @@ std::vector<int> drop(std::vector<std::vector<int> >& grid, int c, int column) {
     return coord;
 }
 
-// this function checks if the most recent move results in a win, lost, interim, and draw.
-// returns the state of the grid
-// r and c starts at 0
-State check(std::vector<std::vector<int> >& grid, int r, int c) {
-    int columns = grid[0].size();
-    int rows = grid.size();
-    int choice = grid[r][c];
-    int count = 0;
-    int minimum = min(r,c);
-    int maximum = max(r,c);
-    
-    // checks entire row
-    for (int i = 0; i < columns; i++) {
-        if (grid[r][i] == choice) {
-            count++;
-        } else {
-            count = 0;
+// this function fills the Zobrist keys from a fixed seed
+// the keys are the same in every run, so hashes can be stored on disk
+void initZobrist() {
+    Rng rng;
+    seedRng(rng, 0x436F6E6E65637434ULL);
+    for (int p = 0; p < 2; p++) {
+        for (int i = 0; i < MAX_CELLS; i++) {
+            zobrist[p][i] = nextRandom(rng);
         }
-        
-        if (count == 4) {
-            return won;
+    }
+}
+
+// this function computes the bitboard geometry for a rows x columns board
+// connect is the number of discs in a row that wins
+// 6x7, 7x8 and 7x9 with 4 in a row and 6x9 with 5 in a row use kernels compiled for their size
+void initShape(Shape& shape, int rows, int columns, int connect) {
+    const int dr[4] = {1, 0, 1, -1};   // row step of each direction
+    const int dc[4] = {0, 1, 1, 1};    // column step of each direction
+    shape.rows = rows;
+    shape.columns = columns;
+    shape.connect = connect;
+    shape.mirror = (columns-1)*rows;
+    shape.leftHalf = (1u << ((columns+1)/2)) - 1;
+    // center first (the right one of the two middle columns of an even board), then alternating left and right
+    // e.g. 3 2 4 1 5 0 6 for 7 columns and 3 2 4 1 5 0 for 6; every column appears once
+    for (int i = 0; i < columns; i++) {
+        shape.order[i] = columns/2 + ((i % 2 == 0) ? i/2 : -(i+1)/2);
+    }
+    for (int d = 0; d < 4; d++) {
+        shape.shift[d] = dc[d]*rows + dr[d];
+        shape.winStart[d] = 0;
+        for (int c = 0; c < columns; c++) {
+            for (int r = 0; r < rows; r++) {
+                // the last disc of the line has to stay on the board
+                int rEnd = r + (connect-1)*dr[d];
+                int cEnd = c + (connect-1)*dc[d];
+                if (rEnd >= 0 && rEnd < rows && cEnd < columns) {
+                    shape.winStart[d] |= 1ULL << (c*rows + r);
+                }
+                // steps to the edge, forwards and backwards
+                int forward = columns - 1 - c;
+                int backward = c;
+                if (dr[d] == 1) {
+                    forward = min(forward, rows - 1 - r);
+                    backward = min(backward, r);
+                } else if (dr[d] == -1) {
+                    forward = min(forward, r);
+                    backward = min(backward, rows - 1 - r);
+                }
+                if (dc[d] == 0) {
+                    forward = rows - 1 - r;
+                    backward = r;
+                }
+                shape.reach[c*rows + r][d][0] = forward;
+                shape.reach[c*rows + r][d][1] = backward;
+            }
         }
     }
     
-    // checks entire column
-    count = 0;
-    for (int i = 0; i < rows; i++) {
-        if (grid[i][c] == choice) {
-            count++;
-        } else {
-            count = 0;
-        }
-        
-        if (count == 4) {
-            return won;
+    // the common board sizes get kernels compiled for their geometry
+    if (rows == 6 && columns == 7 && connect == 4) {
+        useGeometry<FixedGeometry<6, 7, 4> >(shape);
+    } else if (rows == 7 && columns == 8 && connect == 4) {
+        useGeometry<FixedGeometry<7, 8, 4> >(shape);
+    } else if (rows == 7 && columns == 9 && connect == 4) {
+        useGeometry<FixedGeometry<7, 9, 4> >(shape);
+    } else if (rows == 6 && columns == 9 && connect == 5) {
+        useGeometry<FixedGeometry<6, 9, 5> >(shape);
+    } else {
+        useGeometry<RuntimeGeometry>(shape);
+    }
+}
+
+// this function makes the kernels of Geometry the ones used for shape (see check, winningCells, rollout and rolloutBatch)
+template <class Geometry>
+void useGeometry(Shape& shape) {
+    shape.checkKernel = checkWith<Geometry>;
+    shape.winningCellsKernel = winningCellsWith<Geometry>;
+    shape.rolloutKernel = rolloutWith<Geometry>;
+    shape.rolloutBatchKernel = rolloutBatchWith<Geometry>;
+}
+
+// this function converts the grid into a bitboard position
+// grid row 0 is the top row; bitboard row 0 is the bottom row
+Position toPosition(const Shape& shape, std::vector<std::vector<int> >& grid) {
+    Position pos;
+    pos.shape = &shape;
+    pos.stones[0] = 0;
+    pos.stones[1] = 0;
+    pos.key = 0;
+    pos.mirrorKey = 0;
+    pos.legal = 0;
+    pos.moves = 0;
+    for (int c = 0; c < shape.columns; c++) {
+        pos.height[c] = 0;
+        for (int r = 0; r < shape.rows; r++) {
+            int state = grid[shape.rows-1-r][c];
+            if (state != 2) {
+                pos.stones[state] |= 1ULL << (c*shape.rows + r);
+                pos.key ^= zobrist[state][c*shape.rows + r];
+                pos.mirrorKey ^= zobrist[state][(shape.columns-1-c)*shape.rows + r];
+                pos.height[c]++;
+                pos.moves++;
+            }
         }
+        if (pos.height[c] < shape.rows) pos.legal |= 1u << c;
     }
-    
-    // checks negative diagonal
-    count = 0;
-    int i = 0;
-    while ((r-minimum+i) <= (rows-1) && (c-minimum+i) <= (columns-1)) {
-        if (grid[r-minimum+i][c-minimum+i] == choice) {
-            count++;
-        } else {
-            count = 0;
+    return pos;
+}
+
+// returns true if the column still has space
+// col starts counting from 0
+bool canDrop(const Position& pos, int col) {
+    return (pos.legal >> col) & 1;
+}
+
+// returns the player to move| 'o': 0; 'x': 1;
+// x goes first, so x moves whenever the number of discs is even
+int sideToMove(const Position& pos) {
+    return (pos.moves % 2 == 0) ? 1 : 0;
+}
+
+// this function picks a uniformly random column (from 0) that has space
+// the board must not be full
+template <class Geometry>
+int randomLegalWith(const Position& pos, Rng& rng) {
+#ifdef __BMI2__
+    // deposit a single bit at the position of the n-th set bit of legal
+    uint32_t n = randomBelow(rng, __builtin_popcount(pos.legal));
+    return __builtin_ctz(_pdep_u32(1u << n, pos.legal));
+#else
+    // branch-free compaction of the legal columns, cheaper than a software popcount and bit loop
+    int available[MAX_COLUMNS + 1];
+    int count = 0;
+    for (int i = 0; i < Geometry::columns(pos); i++) {
+        available[count] = i;
+        count += (pos.legal >> i) & 1;
+    }
+    return available[randomBelow(rng, count)];
+#endif
+}
+
+// randomLegalWith for any board size
+int randomLegal(const Position& pos, Rng& rng) {
+    return randomLegalWith<RuntimeGeometry>(pos, rng);
+}
+
+// this function drops the 'x' or 'o' down the specified column of the bitboard
+// the column must have space (see canDrop)
+// 'o': choice = 0; 'x': choice = 1;
+// col starts counting from 0
+// returns the bit index of the placed disc
+template <class Geometry>
+int dropWith(Position& pos, int choice, int col) {
+    int bit = col*Geometry::rows(pos) + pos.height[col];
+    pos.stones[choice] |= 1ULL << bit;
+    pos.key ^= zobrist[choice][bit];
+    pos.mirrorKey ^= zobrist[choice][Geometry::mirror(pos) - col*Geometry::rows(pos) + pos.height[col]];
+    pos.height[col]++;
+    pos.moves++;
+    if (pos.height[col] == Geometry::rows(pos)) pos.legal &= ~(1u << col);
+    return bit;
+}
+
+// dropWith for any board size
+int drop(Position& pos, int choice, int col) {
+    return dropWith<RuntimeGeometry>(pos, choice, col);
+}
+
+// this function takes back the most recent disc of the specified column
+// col starts counting from 0
+void undo(Position& pos, int choice, int col) {
+    pos.height[col]--;
+    pos.moves--;
+    pos.legal |= 1u << col;
+    int bit = col*pos.shape->rows + pos.height[col];
+    pos.stones[choice] &= ~(1ULL << bit);
+    pos.key ^= zobrist[choice][bit];
+    pos.mirrorKey ^= zobrist[choice][pos.shape->mirror - col*pos.shape->rows + pos.height[col]];
+}
+
+// this function checks if the discs of choice contain connect in a row anywhere on the board
+// each direction shifts the mask onto itself, doubling the run length each time
+// a handful of word operations per direction: the rollouts and the solver use this one
+// returns won or interim
+template <class Geometry>
+State checkWith(const Position& pos, int choice) {
+    uint64_t m = pos.stones[choice];
+    int connect = Geometry::connect(pos);
+    for (int d = 0; d < 4; d++) {
+        uint64_t start = Geometry::winStart(pos, d);
+        if (start == 0) continue; // no room for connect in a row in this direction
+        int s = Geometry::shift(pos, d);
+        uint64_t runs = m;  // bit b is set if the run of length starting at b is complete
+        int length = 1;
+        while (2*length <= connect) {
+            runs &= runs >> (length*s);
+            length *= 2;
         }
-        
-        if (count == 4) {
+        if (length < connect) {
+            runs &= runs >> ((connect - length)*s);
+        }
+        if (runs & start) {
             return won;
         }
-        i++;
     }
-    
-    // checks positive diagonal
-    count = 0;
-    i = 0;
-    while ((r+min(c,rows-1-r)-i) >= 0 && (c-min(c,rows-1-r)+i) <= (columns-1)) {
-        if (grid[r+min(c,rows-1-r)-i][c-min(c,rows-1-r)+i] == choice) {
-            count++;
-        } else {
-            count = 0;
-        }
-        
-        if (count == 4) {
+    return interim;
+}
+
+// checkWith of the geometry chosen for the board by initShape
+State check(const Position& pos, int choice) {
+    return pos.shape->checkKernel(pos, choice);
+}
+
+// this function checks if the disc just placed at bit completes connect in a row
+// counts outwards from the disc in the four directions and stops at the first cell of another kind
+// O(connect) per call, used where a move comes from outside a search
+// returns won or interim
+State check(const Position& pos, int choice, int bit) {
+    const Shape& shape = *pos.shape;
+    uint64_t m = pos.stones[choice];
+    for (int d = 0; d < 4; d++) {
+        int s = shape.shift[d];
+        int count = 1;
+        int forward = min((int) shape.reach[bit][d][0], shape.connect - 1);
+        int backward = min((int) shape.reach[bit][d][1], shape.connect - 1);
+        for (int k = 1; k <= forward && ((m >> (bit + k*s)) & 1); k++) count++;
+        for (int k = 1; k <= backward && ((m >> (bit - k*s)) & 1); k++) count++;
+        if (count >= shape.connect) {
             return won;
         }
-        i++;
     }
-    
     return interim;
 }
 
+// this function finds the cells where a disc of choice would complete connect in a row
+// for every line of connect cells, the cell is reported when all the other cells hold discs of choice
+// (prefix and suffix products of the shifted masks keep this linear in connect)
+// returns a mask of empty and occupied cells alike; callers intersect it with the cells they can play
+template <class Geometry>
+uint64_t winningCellsWith(const Position& pos, int choice) {
+    return winningCellsOf<Geometry>(pos, pos.stones[choice]);
+}
+
+// winningCellsWith for the discs of one side given as a mask, for boards that are not a Position (see rolloutBatchWith)
+template <class Geometry>
+uint64_t winningCellsOf(const Position& pos, uint64_t discs) {
+    uint64_t m = discs;
+    uint64_t cells = 0;
+    uint64_t prefix[MAX_CELLS + 1];
+    uint64_t suffix[MAX_CELLS + 1];
+    int k = Geometry::connect(pos);
+    for (int d = 0; d < 4; d++) {
+        uint64_t start = Geometry::winStart(pos, d);
+        if (start == 0) continue;
+        int s = Geometry::shift(pos, d);
+        if (k == 4) {
+            // the usual board, written out: the loops below keep their products in memory unless they are unrolled
+            uint64_t m1 = m >> s, m2 = m >> (2*s), m3 = m >> (3*s);
+            cells |= (start & m1 & m2 & m3) | ((start & m & m2 & m3) << s)
+                   | ((start & m & m1 & m3) << (2*s)) | ((start & m & m1 & m2) << (3*s));
+            continue;
+        }
+        // prefix[j]: discs in cells 0..j-1 of the line; suffix[j]: discs in cells j..k-1
+        prefix[0] = start;
+        for (int j = 0; j < k; j++) prefix[j+1] = prefix[j] & (m >> (j*s));
+        suffix[k] = ~0ULL;
+        for (int j = k - 1; j >= 0; j--) suffix[j] = suffix[j+1] & (m >> (j*s));
+        for (int j = 0; j < k; j++) {
+            cells |= (prefix[j] & suffix[j+1]) << (j*s);
+        }
+    }
+    return cells;
+}
+
+// winningCellsWith of the geometry chosen for the board by initShape
+uint64_t winningCells(const Position& pos, int choice) {
+    return pos.shape->winningCellsKernel(pos, choice);
+}
+
+// returns true if every column is filled up
+bool isFull(const Position& pos) {
+    return pos.legal == 0;
+}
+
+// returns the key shared by a position and its mirror image: the smaller of their Zobrist keys
+// transposition tables and the opening book store a position and its mirror image as one entry
+uint64_t canonicalKey(const Position& pos) {
+    return std::min(pos.key, pos.mirrorKey);
+}
+
+// converts a column (from 0) between pos and the orientation of canonicalKey
+// the mirror image is the canonical one when its key is smaller; the conversion is its own inverse
+int canonicalColumn(const Position& pos, int col) {
+    return (pos.key <= pos.mirrorKey) ? col : pos.shape->columns - 1 - col;
+}
+
+// this function seeds the generator
+// the four words of state are filled by splitmix64, which never leaves them all zero
+void seedRng(Rng& rng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        seed += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        rng.s[i] = z ^ (z >> 31);
+    }
+}
+
+// this function returns the next 64 random bits (xoshiro256**)
+uint64_t nextRandom(Rng& rng) {
+    uint64_t* s = rng.s;
+    uint64_t x = s[1] * 5;
+    uint64_t result = ((x << 7) | (x >> 57)) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+// this function returns a uniformly distributed integer in [0, n)
+// multiply-shift with rejection (Lemire), so there is no modulo bias and usually no division
+uint32_t randomBelow(Rng& rng, uint32_t n) {
+    uint64_t m = (nextRandom(rng) >> 32) * n;
+    uint32_t low = (uint32_t) m;
+    if (low < n) {
+        uint32_t threshold = -n % n;
+        while (low < threshold) {
+            m = (nextRandom(rng) >> 32) * n;
+            low = (uint32_t) m;
+        }
+    }
+    return m >> 32;
+}
+
 // this function implements the two player mode
-void twoPlayerMode(std::vector<std::vector<int> >& grid) {
+void twoPlayerMode(std::vector<std::vector<int> >& grid, int connect) {
     int choice;
     int otherChoice;
     int count = 0;
     int move;
-    int drawChecker;
+    int bit;
+    State st = interim;
+    std::vector<int> coords(2); // coordinates of the last disc in the grid
     bool xo = true;
     while (xo) {
         cout << "Please choose 1 for x or 0 for o. x will go first: ";
@@ -291,15 +1288,16 @@ void twoPlayerMode(std::vector<std::vector<int> >& grid) {
         otherChoice = 1;
     }
     
+    // the bitboard mirrors the grid for win and draw detection
+    Shape shape;
+    initShape(shape, grid.size(), grid[0].size(), connect);
+    Position pos = toPosition(shape, grid);
+    
     printGrid(grid);
     
     while (st == interim) {
         // check for draw
-        drawChecker = 0;
-        for (int i = 0; i < grid[0].size(); i++) {
-            if (grid[0][i] != 2) drawChecker++;
-        }
-        if (drawChecker == grid[0].size()) {st = draw; break;}
+        if (isFull(pos)) {st = draw; break;}
         
         if (count == 0 && choice == 0) {
             // user 2 turn
@@ -307,8 +1305,9 @@ void twoPlayerMode(std::vector<std::vector<int> >& grid) {
             cin >> move;
             cin.ignore();
             coords = drop(grid, otherChoice, move);
+            bit = drop(pos, otherChoice, coords[1]);
             printGrid(grid);
-            st = check(grid, coords[0], coords[1]);
+            st = check(pos, otherChoice, bit);
             if (st != interim) {st = lost; break;}
             count++;
         }
@@ -318,23 +1317,21 @@ void twoPlayerMode(std::vector<std::vector<int> >& grid) {
         cin >> move;
         cin.ignore();
         coords = drop(grid, choice, move);
+        bit = drop(pos, choice, coords[1]);
         printGrid(grid);
-        st = check(grid, coords[0], coords[1]);
+        st = check(pos, choice, bit);
         if (st != interim) {break;}
         // check for draw
-        drawChecker = 0;
-        for (int i = 0; i < grid[0].size(); i++) {
-            if (grid[0][i] != 2) drawChecker++;
-        }
-        if (drawChecker == grid[0].size()) {st = draw; break;}
+        if (isFull(pos)) {st = draw; break;}
         
         // user 2 turn
         cout << "Player 2 please choose your next move: ";
         cin >> move;
         cin.ignore();
         coords = drop(grid, otherChoice, move);
+        bit = drop(pos, otherChoice, coords[1]);
         printGrid(grid);
-        st = check(grid, coords[0], coords[1]);
+        st = check(pos, otherChoice, bit);
         if (st != interim) {st = lost; break;}
     }
     
@@ -354,29 +1351,24 @@ void twoPlayerMode(std::vector<std::vector<int> >& grid) {
 }
 
 // this function generates a random move
-int randomizer(std::vector<std::vector<int> >& grid) {
-    int randomIndex;
-    std::vector<int> randomChoices;
-    // available random choices
-    for (int i = 0; i < grid[0].size(); i++) {
-        if (grid[0][i] == 2) {randomChoices.push_back(i+1);}
-    }
-    randomIndex = rand()%(randomChoices.size());
-    return randomChoices[randomIndex];
+int randomizer(Position& pos, Rng& rng) {
+    return randomLegal(pos, rng) + 1;
 }
 
 // this function implements the brute force mode
 // hard code pinrciples to narrow down choices, randomly chooses the remaining choices
-int bruteForce(std::vector<std::vector<int> >& grid1) {
-    std::vector<std::vector<int> > grid = grid1;
+int bruteForce(Position& pos1, Rng& rng) {
+    Position pos = pos1;
     int index;
+    int col;
+    int bit;
     State st;
     // available choices
     struct AI AI_Info;
     AI_Info.choices.clear();
     AI_Info.ranking.clear();
-    for (int i = 0; i < grid[0].size(); i++) {
-        if (grid[0][i] == 2) {
+    for (int i = 0; i < pos.shape->columns; i++) {
+        if (canDrop(pos, i)) {
             AI_Info.choices.push_back(i+1);
             AI_Info.ranking.push_back(1);
         }
@@ -384,39 +1376,27 @@ int bruteForce(std::vector<std::vector<int> >& grid1) {
     
     std::vector<int> choices(2);
     int humanChoice, computerChoice;
-    choices = determineComputerChoice(grid);
+    choices = determineComputerChoice(pos);
     computerChoice = choices[0];
     humanChoice = choices[1];
     
     
     // brute force algorithm
     for (int i = 0; i < AI_Info.choices.size(); i++) {
-        /*
-        if (grid[1][AI_Info.choices[i] ] == 2) {
-            // check if this computer move sets up the human player for a win
-            coords = drop(grid, computerChoice, AI_Info.choices[i]);
-            grid[coords[0]][coords[1] ] = 2; // reset grid to blank
-            grid[coords[0]-1][coords[1] ] = humanChoice; // set human move
-            st = check(grid, coords[0]-1, coords[1]);
-            grid[coords[0]-1][coords[1] ] = 2; // reset grid to blank
-            if (st == won) {
-                AI_Info.ranking[i] = 0;
-            }
-        }
-        */
+        col = AI_Info.choices[i] - 1;
         
         // check winning moves for human
-        coords = drop(grid, humanChoice, AI_Info.choices[i]);
-        st = check(grid, coords[0], coords[1]);
-        grid[coords[0]][coords[1]] = 2; // reset grid to blank
+        bit = drop(pos, humanChoice, col);
+        st = check(pos, humanChoice, bit);
+        undo(pos, humanChoice, col);
         if (st == won) {
             AI_Info.ranking[i] = std::numeric_limits<int>::max() - 1;
         }
         
         // check winning moves for computer (one move ahead)
-        coords = drop(grid, computerChoice, AI_Info.choices[i]);
-        st = check(grid, coords[0], coords[1]);
-        grid[coords[0]][coords[1]] = 2; // reset grid to blank
+        bit = drop(pos, computerChoice, col);
+        st = check(pos, computerChoice, bit);
+        undo(pos, computerChoice, col);
         if (st == won) {
             AI_Info.ranking[i] = std::numeric_limits<int>::max();
         }
@@ -433,18 +1413,20 @@ int bruteForce(std::vector<std::vector<int> >& grid1) {
     
     // choices vector is narrowed down at this point
     // randomly chooses from the choices vector
-    index = rand()%(AI_Info.choices.size());
+    index = randomBelow(rng, AI_Info.choices.size());
     return AI_Info.choices[index];
 }
 
 // this function implements a computer mode against the player
-void computerMode(std::vector<std::vector<int> >& grid1, std::function<int(std::vector<std::vector<int> >&)> computer) {
+void computerMode(std::vector<std::vector<int> >& grid1, int connect, std::function<int(Position&)> computer) {
     std::vector<std::vector<int> > grid = grid1;
     int choice;
     int otherChoice;
     int count = 0;
     int move;
-    int drawChecker;
+    int bit;
+    State st = interim;
+    std::vector<int> coords(2); // coordinates of the last disc in the grid
     bool xo = true;
     while (xo) {
         cout << "Please choose 1 for x or 0 for o. x will go first: ";
@@ -461,15 +1443,16 @@ void computerMode(std::vector<std::vector<int> >& grid1, std::function<int(std::
         otherChoice = 1;
     }
     
+    // the bitboard mirrors the grid for win and draw detection
+    Shape shape;
+    initShape(shape, grid.size(), grid[0].size(), connect);
+    Position pos = toPosition(shape, grid);
+    
     printGrid(grid);
     
     while (st == interim) {
         // check for draw
-        drawChecker = 0;
-        for (int i = 0; i < grid[0].size(); i++) {
-            if (grid[0][i] != 2) drawChecker++;
-        }
-        if (drawChecker == grid[0].size()) {st = draw; break;}
+        if (isFull(pos)) {st = draw; break;}
         
         if (count == 0 && choice == 1) {
             // user turn
@@ -477,31 +1460,30 @@ void computerMode(std::vector<std::vector<int> >& grid1, std::function<int(std::
             cin >> move;
             cin.ignore();
             coords = drop(grid, choice, move);
+            bit = drop(pos, choice, coords[1]);
             printGrid(grid);
-            st = check(grid, coords[0], coords[1]);
+            st = check(pos, choice, bit);
             if (st != interim) {break;}
             count++;
         }
         
         // computer turn
-        coords = drop(grid, otherChoice, computer(grid));
+        coords = drop(grid, otherChoice, computer(pos));
+        bit = drop(pos, otherChoice, coords[1]);
         printGrid(grid);
-        st = check(grid, coords[0], coords[1]);
+        st = check(pos, otherChoice, bit);
         if (st != interim) {st = lost; break;}
         // check for draw
-        drawChecker = 0;
-        for (int i = 0; i < grid[0].size(); i++) {
-            if (grid[0][i] != 2) drawChecker++;
-        }
-        if (drawChecker == grid[0].size()) {st = draw; break;}
+        if (isFull(pos)) {st = draw; break;}
         
         // user turn
         cout << "Please choose your next move: ";
         cin >> move;
         cin.ignore();
         coords = drop(grid, choice, move);
+        bit = drop(pos, choice, coords[1]);
         printGrid(grid);
-        st = check(grid, coords[0], coords[1]);
+        st = check(pos, choice, bit);
     }
     
     switch(st) {
@@ -519,277 +1501,2449 @@ void computerMode(std::vector<std::vector<int> >& grid1, std::function<int(std::
     }
 }
 
-// this function implements Monte Carlo Tree Search during runtime against human player
-// able to specify the time allotted for search
-// use latin hypercube sampling vs. Monte Carlo sampling
-////////// MCTS becomes better (game tree is more explored) as the game progresses (in progress)////////////
-// returns the column number with the highest heuristic value
-int MonteCarloTreeSearch(std::vector<std::vector<int> >& grid) {
-    const unsigned long int BRANCHES = 50000; // number of branches of searching (Monte Carlo sample size)
-    std::vector<std::vector<int> > grid1 = grid;
-    std::vector<std::vector<int> > tempgrid = grid;
-    int index;
-    int max;
-    int rows = grid.size();
-    int columns = grid[0].size();
-    std::vector<Node*> leaves;
-    std::vector<int> c;
-    int col;
-    State st = interim;
-    int choice;
-    Node* tempchild;
-    
-    std::vector<int> choices(2);
-    int humanChoice, computerChoice;
-    choices = determineComputerChoice(grid1);
-    computerChoice = choices[0];
-    humanChoice = choices[1];
-    
+// this function lets the engine of a computer player choose a move for the side to move
+// the MCTS and alpha-beta engines play the move of engine.book when the position is in it
+// the transposition table is allocated by the first MCTS or alpha-beta search and kept between them
+// engine.stats receives the statistics of the search, and engine.statsLog a JSON line of them when it is set
+// returns the column number
+int engineMove(Engine& engine, Position& pos) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point allocated;
+    int move = 0;
+    engine.stats = SearchStats();
     
-    // available choices
-    struct AI info;
-    info.choices.clear();
-    info.ranking.clear();
-    for (int i = 0; i < grid1[0].size(); i++) {
-        if (grid1[0][i] == 2) {
-            info.choices.push_back(i+1);   // stores currently avaiable choices
-            info.ranking.push_back(0);     // stores the MCTS heuristic values for the respective choices
-        }
+    // a book position is answered without a search
+    if (engine.book != nullptr && (engine.type == mctsEngine || engine.type == alphaBetaEngine)) {
+        move = probeBook(*engine.book, pos);
     }
-    
-    leaves.clear();
-    for (int j = 0; j < info.choices.size(); j++) {
-        leaves.push_back(new Node);
-        leaves[j]->column = info.choices[j];
-        // Monte Carlo Tree Search Algorithm
-        for (int i = 0; i < BRANCHES; i++) {
-            tempchild = mcts(grid1, leaves[j]);
-            backPropagate(tempchild, tempchild->value);
+    if (move > 0) {
+        stopPondering(engine.mcts);
+        engine.stats.book = true;
+        if (engine.config.verbose) {
+            cout << "Opening Book: column " << move << endl;
         }
-    }
-    
-    // brute force algorithm
-    for (int i = 0; i < info.choices.size(); i++) {
-        // check winning moves for human
-        c = drop(tempgrid, humanChoice, info.choices[i]);
-        st = check(tempgrid, c[0], c[1]);
-        tempgrid[c[0]][c[1]] = 2; // reset grid to blank
-        c.clear();
-        if (st == won) {
-            for (int i = 0; i < leaves.size(); i++) {
-                // delete the entire tree
-                destroyTree(leaves[i]);
-            }
-            return info.choices[i];
+    } else {
+        switch(engine.type) {
+            case randomEngine :
+                move = randomizer(pos, engine.rng);
+                break;
+            case bruteForceEngine :
+                move = bruteForce(pos, engine.rng);
+                break;
+            case mctsEngine :
+                if (engine.table.memory.empty()) {
+                    resizeTable(engine.table, engine.config.tableMB, engine.config.tableReplacement);
+                }
+                move = MonteCarloTreeSearch(pos, engine.config, engine.mcts, &engine.table, engine.rng, engine.stats);
+                break;
+            case alphaBetaEngine :
+                if (engine.table.memory.empty()) {
+                    resizeTable(engine.table, engine.config.tableMB, engine.config.tableReplacement);
+                }
+                allocated = std::chrono::steady_clock::now();
+                move = alphaBeta(pos, engine.config, engine.table, engine.stats);
+                engine.stats.prepareMs = std::chrono::duration<double, std::milli>(allocated - start).count();
+                break;
         }
-        st = interim;
-    }
-    
-    cout << "Monte Carlo Tree Search Mode: " << endl;
-    cout << "Heuristics: |";
-    for (int i = 0; i < leaves.size(); i++) {
-        cout << leaves[i]->value << '|';
     }
-    cout << endl;
-    cout << "Column Numbers: |";
-    for (int i = 0; i < leaves.size(); i++) {
-        cout << leaves[i]->column << '|';
-    }
-    cout << endl;
-    
-    // the column number of the highest heuristic value will be chosen (leads to higher probability of winning)
-    max = std::numeric_limits<int>::min(); // initialize max
-    for (int i = 0; i < leaves.size(); i++) {
-        if (leaves[i]->value > max) {
-            max = leaves[i]->value;
-            index = i;
-        }
+    engine.stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (engine.statsLog != nullptr) {
+        writeStats(*engine.statsLog, engine.stats, engine.type);
     }
-    
-    choice = leaves[index]->column;
-    
-    for (int i = 0; i < leaves.size(); i++) {
-        // delete the entire tree
-        destroyTree(leaves[i]);
+    return move;
+}
+
+// this function writes a SearchStats record as one JSON object on one line
+void writeStats(std::ostream& out, const SearchStats& stats, EngineType type) {
+    out << "{\"engine\":\"" << engineNames[type] << "\",\"iterations\":" << stats.iterations
+        << ",\"nodes\":" << stats.nodes << ",\"reused\":" << stats.reused << ",\"pruned\":" << stats.pruned
+        << ",\"rate\":" << (unsigned long) stats.rate
+        << ",\"depth\":" << stats.depth << ",\"average_depth\":" << setprecision(4) << stats.averageDepth
+        << ",\"probes\":" << stats.probes << ",\"hits\":" << stats.hits
+        << ",\"hit_rate\":" << (stats.probes > 0 ? (double) stats.hits / stats.probes : 0.0)
+        << ",\"memory\":" << stats.memory << ",\"score\":" << stats.score
+        << ",\"ms\":" << stats.milliseconds << ",\"prepare_ms\":" << stats.prepareMs
+        << ",\"search_ms\":" << stats.searchMs << ",\"finish_ms\":" << stats.finishMs
+        << ",\"book\":" << (stats.book ? "true" : "false") << "}" << endl;
+}
+
+// this function forgets everything the engine kept from earlier moves (trees and transposition table)
+void clearEngine(Engine& engine) {
+    stopPondering(engine.mcts);
+    for (int t = 0; t < engine.mcts.pools.size(); t++) {
+        destroyTree(engine.mcts.pools[t]);
     }
-    
-    return choice;
+    engine.table.memory.clear();
 }
 
-// this function recursively deletes the entire tree from memory
-// argument is the root of the tree to be deleted
-void destroyTree(Node* n) {
-    if (n->children.size() != 0) {
-        for (int i = 0; i < n->children.size(); i++) {
-            destroyTree(n->children[i]);
-        }
+// this function reads a column of the engine protocol: 1-9, then a-g for columns 10-16
+// returns the column number, 0 for an invalid character
+int columnOf(char c) {
+    if (c >= '1' && c <= '9') return c - '0';
+    if (c >= 'a' && c < 'a' + MAX_COLUMNS - 9) return c - 'a' + 10;
+    if (c >= 'A' && c < 'A' + MAX_COLUMNS - 9) return c - 'A' + 10;
+    return 0;
+}
+
+// this function writes a column number in the notation of columnOf
+char columnName(int column) {
+    return (column <= 9) ? '0' + column : 'a' + column - 10;
+}
+
+// this function looks up an engine by its name in engineNames
+// returns the EngineType, -1 for an unknown name
+int engineOf(const std::string& name) {
+    for (int e = 0; e < ENGINE_TYPES; e++) {
+        if (name == engineNames[e]) return e;
     }
-    delete n;
+    return -1;
 }
 
-// this function adds a children node to the parent node
-// this returns the child address
-// if child node of the specified column already exists, that child node will be returned
-Node* addNode(Node* parent, int col) {
-    for (int i = 0; i < parent->children.size(); i++) {
-        if (parent->children[i]->column == col) {return parent->children[i];}
+// this function runs the engine protocol: one command per line from in, the replies go to out
+// it lets another program drive the search engines without the interactive prompts
+//   protocol                         replies "id name Connect4", "id author ..." and "protocolok"
+//   isready                          replies "readyok"
+//   size <rows> <columns> [connect]  sets the board (6 7 4 at the start) and clears the position
+//   newgame                          clears the position and everything the engine kept from earlier moves
+//   position [moves <columns>]       empty board followed by the given moves, x first, e.g. "position moves 4453"
+//   setoption <name> <value>         engine (random, bruteforce, mcts, alphabeta), threads, parallel (none, root, tree),
+//                                    exploration, virtualloss, reuse (0, 1), treesize (nodes), treemb (MB per tree),
+//                                    recycle (0, 1), hash (MB), hashreplace (always, depth, visits), seed,
+//                                    book (file of makeBook, or none), leafplayouts (playouts per MCTS leaf),
+//                                    rave (equivalence visits, 0 for none), rollout (uniform, tactical)
+//   go [movetime <ms>] [nodes <n>]   searches the position with the given budget (the command line budget otherwise)
+//                                    replies "info ..." with the SearchStats and "bestmove <column>" ("bestmove none"
+//                                    when the game is over)
+//   print                            shows the board, top row first
+//   quit                             returns
+// an invalid command is answered with "info string error ..." and changes nothing
+void engineProtocol(std::istream& in, std::ostream& out, Engine& engine) {
+    ProtocolSession session;
+    openSession(session, engine);
+    std::string line;
+    while (std::getline(in, line)) {
+        session.received = std::chrono::steady_clock::now();
+        if (!protocolCommand(session, line, out)) break;
     }
-    
-    //std::unique_ptr<Node> child(new Node);
-    Node* child = new Node;
-    child->column = col;
-    child->parent = parent;
-    parent->children.push_back(child);
-    return child;
+    closeSession(session);
 }
 
-// this function uses the Monte Carlo Tree Search Method to construct a branch from the root node to an end leaf node
-// returns the address of the end leaf node
-// assigns the appropriate heuristic value to the end leaf node
-// won: value = 1; lost: value = -1; draw: value = 0;
-Node* mcts(std::vector<std::vector<int> >& grid, Node* root) {
-    State st = interim;
-    Node* tempRoot = root;
-    Node* tempChild;
-    std::vector<std::vector<int> > currentGrid = grid;
-    std::vector<int> coords(2);
-    struct AI AI_Info;
-    int index;
-    int columns = currentGrid[0].size();
-    int rows = currentGrid.size();
-    int drawChecker;
-    int col;
+// this function sets up a protocol session on the 6x7 board with the empty position, played by engine
+void openSession(ProtocolSession& session, Engine& engine) {
+    session.engine = &engine;
+    initShape(session.shape, 6, 7, 4);
+    session.grid.assign(session.shape.rows, std::vector<int>(session.shape.columns, 2));
+    session.pos = toPosition(session.shape, session.grid);
+    session.over = false;
+    session.received = std::chrono::steady_clock::now();
+}
+
+// this function lets the engine of a protocol session forget the game and unloads the book of the session
+void closeSession(ProtocolSession& session) {
+    Engine& engine = *session.engine;
+    clearEngine(engine);
+    if (engine.book == &session.book) engine.book = nullptr;
+    closeBook(session.book);
+}
+
+// this function carries out one command of the engine protocol (see engineProtocol) on session
+// the replies go to out
+// returns false for quit
+bool protocolCommand(ProtocolSession& session, const std::string& line, std::ostream& out) {
+    Engine& engine = *session.engine;
+    Shape& shape = session.shape;
+    std::vector<std::vector<int> >& grid = session.grid;
+    Position& pos = session.pos;
+    bool& over = session.over;
+    OpeningBook& book = session.book;
+    std::istringstream words(line);
+    std::string command;
+    if (!(words >> command)) return true;
     
-    std::vector<int> choices(2);
-    int humanChoice, computerChoice;
-    choices = determineComputerChoice(currentGrid);
-    computerChoice = choices[0];
-    humanChoice = choices[1];
+    if (command == "quit") {
+        return false;
+    } else if (command == "protocol") {
+        out << "id name Connect4" << '\n' << "id author Michael Wang" << '\n' << "protocolok" << endl;
+    } else if (command == "isready") {
+        out << "readyok" << endl;
+    } else if (command == "size") {
+        int rows = 0, columns = 0, connect = 4;
+        words >> rows >> columns;
+        if (!words.eof() && !(words >> connect)) connect = 0;
+        if (rows < 1 || columns < 1 || columns > MAX_COLUMNS || rows*columns > MAX_CELLS || connect < 2) {
+            out << "info string error the board needs at most " << MAX_CELLS << " cells, " << MAX_COLUMNS
+                << " columns and at least 2 discs in a row" << endl;
+            return true;
+        }
+        // the trees refer to the old shape
+        clearEngine(engine);
+        initShape(shape, rows, columns, connect);
+        grid.assign(rows, std::vector<int>(columns, 2));
+        pos = toPosition(shape, grid);
+        over = false;
+    } else if (command == "newgame") {
+        clearEngine(engine);
+        pos = toPosition(shape, grid);
+        over = false;
+    } else if (command == "position") {
+        std::string word, moves;
+        while (words >> word) {
+            if (word != "moves" && word != "startpos") moves += word;
+        }
+        Position next = toPosition(shape, grid);
+        bool nextOver = false;
+        int illegal = playMoves(next, moves, nextOver);
+        if (illegal > 0) {
+            out << "info string error illegal move " << illegal << endl;
+        } else {
+            pos = next;
+            over = nextOver;
+        }
+    } else if (command == "setoption") {
+        std::string name, value;
+        words >> name >> value;
+        SearchConfig& config = engine.config;
+        bool valid = true;
+        if (name == "engine") {
+            valid = engineOf(value) >= 0;
+            if (valid) engine.type = (EngineType) engineOf(value);
+        } else if (name == "parallel") {
+            valid = (value == "none" || value == "root" || value == "tree");
+            if (valid) {
+                config.parallel = (value == "root") ? rootParallel : (value == "tree") ? treeParallel : sequential;
+                clearEngine(engine);
+            }
+        } else if (name == "threads") {
+            config.threads = atoi(value.c_str());
+            valid = config.threads >= 1;
+            if (!valid) config.threads = 1;
+        } else if (name == "exploration") {
+            config.exploration = atof(value.c_str());
+        } else if (name == "virtualloss") {
+            config.virtualLoss = atoi(value.c_str());
+        } else if (name == "leafplayouts") {
+            config.leafPlayouts = atoi(value.c_str());
+            valid = config.leafPlayouts >= 1;
+            if (!valid) config.leafPlayouts = 1;
+        } else if (name == "rave") {
+            config.raveEquivalence = atof(value.c_str());
+            valid = config.raveEquivalence >= 0;
+            if (!valid) config.raveEquivalence = 0;
+        } else if (name == "rollout") {
+            valid = (value == "uniform" || value == "tactical");
+            if (valid) config.rollout = (value == "tactical") ? tacticalRollouts : uniformRollouts;
+        } else if (name == "reuse") {
+            config.reuseTree = (value == "1");
+        } else if (name == "treesize" || name == "treemb") {
+            unsigned long size = strtoul(value.c_str(), NULL, 10);
+            config.maxNodes = (name == "treemb") ? treeCapacity(size) : size;
+            valid = config.maxNodes > MAX_COLUMNS;
+            if (!valid) config.maxNodes = SearchConfig().maxNodes;
+            clearEngine(engine);
+        } else if (name == "recycle") {
+            config.recycle = (value == "1");
+        } else if (name == "hash") {
+            config.tableMB = strtoul(value.c_str(), NULL, 10);
+            engine.table.memory.clear();
+        } else if (name == "hashreplace") {
+            valid = (value == "always" || value == "depth" || value == "visits");
+            if (valid) {
+                config.tableReplacement = (value == "always") ? replaceAlways : (value == "visits") ? replaceVisits : replaceDepth;
+                engine.table.memory.clear();
+            }
+        } else if (name == "seed") {
+            seedRng(engine.rng, strtoull(value.c_str(), NULL, 10));
+        } else if (name == "book") {
+            if (engine.book == &book) engine.book = nullptr;
+            closeBook(book);
+            valid = (value == "none") || loadBook(book, value.c_str());
+            if (valid && value != "none") engine.book = &book;
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            out << "info string error invalid option " << name << ' ' << value << endl;
+        }
+    } else if (command == "go") {
+        if (over || isFull(pos)) {
+            out << "bestmove none" << endl;
+            return true;
+        }
+        SearchConfig saved = engine.config;
+        // a budget given with go replaces both limits of the command line
+        std::string word;
+        bool budget = false;
+        unsigned long movetime = 0, nodes = 0;
+        while (words >> word) {
+            if (word == "movetime" && words >> movetime) budget = true;
+            if (word == "nodes" && words >> nodes) budget = true;
+        }
+        if (budget) {
+            engine.config.timeLimit = movetime;
+            engine.config.nodeLimit = nodes;
+        }
+        if (engine.config.timeLimit == 0 && engine.config.nodeLimit == 0) {
+            out << "info string error the search needs a time or node budget" << endl;
+            engine.config = saved;
+            return true;
+        }
+        // the time spent waiting for a worker of serveSessions is part of the budget
+        if (engine.config.timeLimit > 0) {
+            unsigned long waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - session.received).count();
+            engine.config.timeLimit = (waited < engine.config.timeLimit) ? engine.config.timeLimit - waited : 1;
+        }
+        int move = engineMove(engine, pos);
+        engine.config = saved;
+        const SearchStats& stats = engine.stats;
+        out << "info engine " << engineNames[engine.type] << " iterations " << stats.iterations
+            << " nodes " << stats.nodes << " time " << (unsigned long) stats.milliseconds
+            << " rate " << (unsigned long) stats.rate << " depth " << stats.depth
+            << " hits " << stats.hits << '/' << stats.probes << " memory " << stats.memory
+            << " score " << stats.score << " book " << stats.book << endl;
+        out << "bestmove " << columnName(move) << endl;
+    } else if (command == "print") {
+        for (int r = shape.rows - 1; r >= 0; r--) {
+            for (int c = 0; c < shape.columns; c++) {
+                uint64_t cell = 1ULL << (c*shape.rows + r);
+                out << ' ' << ((pos.stones[1] & cell) ? 'x' : (pos.stones[0] & cell) ? 'o' : '.');
+            }
+            out << '\n';
+        }
+        for (int c = 0; c < shape.columns; c++) {
+            out << ' ' << columnName(c + 1);
+        }
+        out << endl;
+    } else {
+        out << "info string error unknown command " << command << endl;
+    }
+    return true;
+}
 
-    while(st == interim) {
-        // check for draw
-        drawChecker = 0;
-        for (int i = 0; i < currentGrid[0].size(); i++) {
-            if (currentGrid[0][i] != 2) drawChecker++;
+// this function starts threads workers, each with its own task deque
+void startPool(WorkerPool& pool, int threads) {
+    pool.stopping = false;
+    pool.pending = 0;
+    for (int w = 0; w < threads; w++) {
+        pool.queues.push_back(std::unique_ptr<WorkerPool::Queue>(new WorkerPool::Queue()));
+    }
+    for (int w = 0; w < threads; w++) {
+        pool.threads.push_back(std::thread(runWorker, std::ref(pool), w));
+    }
+}
+
+// this function queues a task on the deque of worker, or on the next deque in turn when worker is -1
+// (a task submitted by a worker stays on that worker unless another one steals it)
+void submitTask(WorkerPool& pool, const std::function<void(int)>& task, int worker) {
+    if (worker < 0) worker = pool.next++ % pool.queues.size();
+    {
+        std::lock_guard<std::mutex> lock(pool.queues[worker]->mutex);
+        pool.queues[worker]->tasks.push_back(task);
+    }
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.pending++;
+    }
+    pool.wake.notify_one();
+}
+
+// this function is the body of the worker threads of a pool
+// it takes the newest task of its own deque, otherwise the oldest task of the other deques in turn,
+// and sleeps while every deque is empty; it returns when the pool is stopped and no task is left
+void runWorker(WorkerPool& pool, int worker) {
+    int workers = pool.queues.size();
+    while (true) {
+        std::function<void(int)> task;
+        for (int k = 0; k < workers && !task; k++) {
+            WorkerPool::Queue& queue = *pool.queues[(worker + k) % workers];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            if (k == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
         }
-        if (drawChecker == currentGrid[0].size()) {st = draw; break;}
-        
-        // computer's choice
-        AI_Info.choices.clear();
-        for (int i = 0; i < currentGrid[0].size(); i++) {
-            if (currentGrid[0][i] == 2) {
-                AI_Info.choices.push_back(i+1);
-            }
-        }
-        index = rand()%(AI_Info.choices.size());
-        // drop the choice
-        col = AI_Info.choices[index];
-        for (int i = 0; i < rows; i++) {
-            if (currentGrid[i][col-1] != 2) {
-                currentGrid[i-1][col-1] = computerChoice;
-                coords[0] = i-1;
-                coords[1] = col-1;
-            } else if (i == rows-1) {
-                currentGrid[i][col-1] = computerChoice;
-                coords[0] = i;
-                coords[1] = col-1;
-            }
-        }
-        tempChild = addNode(tempRoot , AI_Info.choices[index]);
-        tempRoot = tempChild;
-        st = check(currentGrid, coords[0], coords[1]);
-        if (st != interim) { st = won; break;}
-        // check for draw
-        drawChecker = 0;
-        for (int i = 0; i < currentGrid[0].size(); i++) {
-            if (currentGrid[0][i] != 2) drawChecker++;
+        if (task) {
+            {
+                std::lock_guard<std::mutex> lock(pool.mutex);
+                pool.pending--;
+            }
+            task(worker);
+            continue;
         }
-        if (drawChecker == currentGrid[0].size()) {st = draw; break;}
-        
-        // human's choice
-        AI_Info.choices.clear();
-        for (int i = 0; i < currentGrid[0].size(); i++) {
-            if (currentGrid[0][i] == 2) {
-                AI_Info.choices.push_back(i+1);
-            }
-        }
-        index = rand()%(AI_Info.choices.size());
-        // drop the choice
-        col = AI_Info.choices[index];
-        for (int i = 0; i < rows; i++) {
-            if (currentGrid[i][col-1] != 2) {
-                currentGrid[i-1][col-1] = humanChoice;
-                coords[0] = i-1;
-                coords[1] = col-1;
-            } else if (i == rows-1) {
-                currentGrid[i][col-1] = humanChoice;
-                coords[0] = i;
-                coords[1] = col-1;
-            }
-        }
-        tempChild = addNode(tempRoot , AI_Info.choices[index]);
-        tempRoot = tempChild;
-        st = check(currentGrid, coords[0], coords[1]);
-        if (st != interim) { st = lost; break;}
-    }
-    
-    //////////////////check if we have been to this particular leaf before //////////////////
-    switch(st) {
-        case won :
-            tempChild->value = 1;
-            break;
-        case lost :
-            tempChild->value = -1;
-            break;
-        case draw :
-            tempChild->value = 0;
-            break;
-        case interim :
-            break;
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        pool.wake.wait(lock, [&pool]() {return pool.pending > 0 || pool.stopping;});
+        if (pool.stopping && pool.pending == 0) return;
+    }
+}
+
+// this function lets the workers finish the queued tasks, then joins them
+void stopPool(WorkerPool& pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stopping = true;
+    }
+    pool.wake.notify_all();
+    for (int w = 0; w < pool.threads.size(); w++) {
+        pool.threads[w].join();
+    }
+    pool.threads.clear();
+    pool.queues.clear();
+}
+
+// this function opens a listening socket on address: a TCP port on 127.0.0.1, or a Unix socket path (with a '/')
+// returns the socket, -1 if it cannot be opened or the path names a file that is not a socket
+int listenOn(const std::string& address) {
+    int fd;
+    if (address.find('/') != std::string::npos) {
+        struct sockaddr_un local;
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(local.sun_path)) return -1;
+        strcpy(local.sun_path, address.c_str());
+        // a socket left behind by an earlier server is replaced; any other file at the path is kept
+        struct stat existing;
+        if (lstat(address.c_str(), &existing) == 0) {
+            if (!S_ISSOCK(existing.st_mode)) return -1;
+            unlink(address.c_str());
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (bind(fd, (struct sockaddr*) &local, sizeof(local)) != 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        int port = atoi(address.c_str());
+        if (port < 1 || port > 65535) return -1;
+        struct sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons(port);
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, (struct sockaddr*) &local, sizeof(local)) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, 128) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// this function writes text to the client unless it has disconnected
+void sendReply(Connection& client, const std::string& text) {
+    std::lock_guard<std::mutex> lock(client.mutex);
+    size_t sent = 0;
+    while (client.open && sent < text.size()) {
+        ssize_t n = send(client.fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += n;
+    }
+}
+
+// this function handles one request line of a client of serveSessions
+// returns false for shutdown
+bool serverRequest(SessionServer& server, const std::shared_ptr<Connection>& client, const std::string& line) {
+    std::istringstream words(line);
+    std::string first;
+    if (!(words >> first)) return true;
+    
+    if (first == "new") {
+        std::shared_ptr<Session> session = std::make_shared<Session>();
+        session->engine.config = server.config;
+        session->engine.book = server.book;
+        {
+            std::lock_guard<std::mutex> lock(server.mutex);
+            session->id = server.nextId++;
+            server.sessions[session->id] = session;
+        }
+        seedRng(session->engine.rng, server.seed + session->id);
+        openSession(session->protocol, session->engine);
+        client->sessions.push_back(session->id);
+        sendReply(*client, "session " + std::to_string(session->id) + "\n");
+    } else if (first == "sessions") {
+        std::lock_guard<std::mutex> lock(server.mutex);
+        sendReply(*client, "sessions " + std::to_string(server.sessions.size()) + "\n");
+    } else if (first == "shutdown") {
+        return false;
+    } else {
+        std::shared_ptr<Session> session;
+        if (first.find_first_not_of("0123456789") == std::string::npos) {
+            std::lock_guard<std::mutex> lock(server.mutex);
+            std::map<int, std::shared_ptr<Session> >::iterator found = server.sessions.find(atoi(first.c_str()));
+            if (found != server.sessions.end()) session = found->second;
+        }
+        if (!session) {
+            sendReply(*client, "info string error unknown session " + first + "\n");
+            return true;
+        }
+        SessionCommand command;
+        std::getline(words >> std::ws, command.line);
+        command.client = client;
+        command.received = std::chrono::steady_clock::now();
+        queueCommand(server, session, command);
+    }
+    return true;
+}
+
+// this function appends a command to the queue of session and hands the session to the pool if it is idle
+void queueCommand(SessionServer& server, const std::shared_ptr<Session>& session, const SessionCommand& command) {
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (session->closed) return;
+        session->queue.push_back(command);
+        if (session->running) return;
+        session->running = true;
+    }
+    submitTask(server.pool, [&server, session](int worker) {runSession(server, session, worker);}, -1);
+}
+
+// this function runs the oldest queued command of session on a worker and sends the replies, each line
+// prefixed with the session id; a go searches with the tree and table of the worker (see WorkerMemory)
+// the session goes back to the pool while more commands are queued, so long queues do not starve other sessions
+void runSession(SessionServer& server, const std::shared_ptr<Session>& session, int worker) {
+    SessionCommand command;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        command = session->queue.front();
+        session->queue.pop_front();
+    }
+    ProtocolSession& protocol = session->protocol;
+    Engine& engine = session->engine;
+    std::ostringstream out;
+    std::istringstream words(command.line);
+    std::string name;
+    words >> name;
+    protocol.received = command.received;
+    bool open;
+    if (name == "go") {
+        WorkerMemory& memory = server.memory[worker];
+        // the trees and table entries of another board size would be read as positions of this one
+        if (memory.rows != protocol.shape.rows || memory.columns != protocol.shape.columns
+            || memory.connect != protocol.shape.connect) {
+            for (int t = 0; t < memory.pools.size(); t++) {
+                destroyTree(memory.pools[t]);
+            }
+            memory.table.memory.clear();
+            memory.rows = protocol.shape.rows;
+            memory.columns = protocol.shape.columns;
+            memory.connect = protocol.shape.connect;
+        }
+        // the session's hash and hashreplace options resize the table of the worker (engineMove allocates it)
+        if (memory.tableMB != engine.config.tableMB || memory.table.replacement != engine.config.tableReplacement) {
+            memory.table.memory.clear();
+            memory.tableMB = engine.config.tableMB;
+        }
+        engine.config.ponder = false;  // the trees go back to the worker after the search
+        std::swap(engine.mcts.pools, memory.pools);
+        std::swap(engine.table, memory.table);
+        open = protocolCommand(protocol, command.line, out);
+        std::swap(engine.mcts.pools, memory.pools);
+        std::swap(engine.table, memory.table);
+    } else {
+        open = protocolCommand(protocol, command.line, out);
+    }
+    if (!open) {
+        closeSession(protocol);
+        out << "closed" << endl;
+        std::lock_guard<std::mutex> lock(server.mutex);
+        server.sessions.erase(session->id);
+    }
+    if (command.client) {
+        std::string prefix = std::to_string(session->id) + " ";
+        std::string reply;
+        std::istringstream lines(out.str());
+        std::string line;
+        while (std::getline(lines, line)) {
+            reply += prefix + line + "\n";
+        }
+        sendReply(*command.client, reply);
+    }
+    
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (!open) {
+        session->closed = true;
+        session->queue.clear();
+    }
+    if (session->queue.empty()) {
+        session->running = false;
+    } else {
+        submitTask(server.pool, [&server, session](int next) {runSession(server, session, next);}, worker);
+    }
+}
+
+// this function hosts game sessions for the clients of a local socket and runs their commands on a pool of
+// workers threads, one process for any number of games
+// address is a TCP port on 127.0.0.1 or the path of a Unix socket (anything with a '/'); one request per line:
+//   new                  opens a session with config and book, replies "session <id>"
+//   <id> <command>       runs an engine protocol command (see engineProtocol) on session id; every reply line is
+//                        prefixed with "<id> "; the time budget of go counts from the arrival of the request
+//   <id> quit            closes the session, replies "<id> closed"
+//   sessions             replies "sessions <number of open sessions>"
+//   shutdown             stops the server once the queued commands are done
+// the sessions of a client are closed when it disconnects; the random generator of session id is seeded with seed + id
+// returns false if the socket cannot be opened
+bool serveSessions(const std::string& address, const SearchConfig& config, int workers, uint64_t seed, const OpeningBook* book) {
+    int listener = listenOn(address);
+    if (listener < 0) return false;
+    SessionServer server;
+    server.config = config;
+    server.book = book;
+    server.seed = seed;
+    server.memory.resize(workers);
+    startPool(server.pool, workers);
+    
+    std::map<int, std::shared_ptr<Connection> > clients;
+    std::vector<struct pollfd> polled;
+    bool serving = true;
+    char buffer[4096];
+    while (serving) {
+        polled.clear();
+        polled.push_back({listener, POLLIN, 0});
+        for (std::map<int, std::shared_ptr<Connection> >::iterator c = clients.begin(); c != clients.end(); c++) {
+            polled.push_back({c->first, POLLIN, 0});
+        }
+        if (poll(polled.data(), polled.size(), -1) < 0) continue;
+        if (polled[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0) {
+                std::shared_ptr<Connection> client = std::make_shared<Connection>();
+                client->fd = fd;
+                clients[fd] = client;
+            }
+        }
+        for (int i = 1; i < polled.size() && serving; i++) {
+            if (polled[i].revents == 0) continue;
+            std::shared_ptr<Connection> client = clients[polled[i].fd];
+            ssize_t n = recv(client->fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                client->input.append(buffer, n);
+                size_t end;
+                while (serving && (end = client->input.find('\n')) != std::string::npos) {
+                    std::string line = client->input.substr(0, end);
+                    client->input.erase(0, end + 1);
+                    if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+                    serving = serverRequest(server, client, line);
+                }
+                continue;
+            }
+            // the client disconnected: its sessions quit after the commands already queued
+            for (int k = 0; k < client->sessions.size(); k++) {
+                std::shared_ptr<Session> session;
+                {
+                    std::lock_guard<std::mutex> lock(server.mutex);
+                    std::map<int, std::shared_ptr<Session> >::iterator found = server.sessions.find(client->sessions[k]);
+                    if (found != server.sessions.end()) session = found->second;
+                }
+                if (session) queueCommand(server, session, {"quit", nullptr, std::chrono::steady_clock::now()});
+            }
+            {
+                std::lock_guard<std::mutex> lock(client->mutex);
+                client->open = false;
+                close(client->fd);
+            }
+            clients.erase(polled[i].fd);
+        }
+    }
+    
+    stopPool(server.pool);
+    for (std::map<int, std::shared_ptr<Connection> >::iterator c = clients.begin(); c != clients.end(); c++) {
+        std::lock_guard<std::mutex> lock(c->second->mutex);
+        c->second->open = false;
+        close(c->first);
+    }
+    for (std::map<int, std::shared_ptr<Session> >::iterator s = server.sessions.begin(); s != server.sessions.end(); s++) {
+        closeSession(s->second->protocol);
+    }
+    close(listener);
+    if (address.find('/') != std::string::npos) unlink(address.c_str());
+    return true;
+}
+
+// this function plays one game between two engines from the empty board
+// players[1] plays x and moves first, players[0] plays o
+// returns the winner (0 or 1), -1 for a draw; an engine that returns a column without space loses
+int playGame(const Shape& shape, Engine* players[2]) {
+    std::vector<std::vector<int> > grid(shape.rows, std::vector<int>(shape.columns, 2));
+    Position pos = toPosition(shape, grid);
+    
+    while (!isFull(pos)) {
+        int player = sideToMove(pos);
+        int col = engineMove(*players[player], pos) - 1;
+        if (col < 0 || col >= shape.columns || !canDrop(pos, col)) return 1 - player;
+        int bit = drop(pos, player, col);
+        if (check(pos, player, bit) == won) return player;
     }
+    return -1;
+}
+
+// this function converts an expected score (0 to 1) into a difference of Elo ratings
+double eloDifference(double score) {
+    return 400.0 * log10(score / (1.0 - score));
+}
+
+// this function plays a match between match.engines[0] and match.engines[1] on match.jobs threads
+// every thread keeps its own pair of engines and takes the next game number until all are played
+// the results are reported for engines[0]: wins, draws and losses, the Elo difference with a
+// 95% confidence interval, and the games per second
+void selfPlay(const MatchConfig& match) {
+    Shape shape;
+    initShape(shape, match.rows, match.columns, match.connect);
+    std::atomic<int> next{0};
+    std::atomic<int> wins{0}, draws{0}, losses{0};
+    std::atomic<int> xWins{0};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    auto worker = [&]() {
+        Engine engines[2];
+        for (int e = 0; e < 2; e++) {
+            engines[e].type = match.engines[e];
+            engines[e].config = match.config;
+        }
+        for (int g = next++; g < match.games; g = next++) {
+            // engines[0] plays x in the even games
+            Engine* players[2];
+            players[1] = &engines[g % 2];
+            players[0] = &engines[1 - g % 2];
+            Rng rng;
+            seedRng(rng, match.seed + g);
+            for (int e = 0; e < 2; e++) {
+                clearEngine(engines[e]);
+                seedRng(engines[e].rng, nextRandom(rng));
+            }
+            int winner = playGame(shape, players);
+            if (winner == -1) {
+                draws++;
+            } else if (players[winner] == &engines[0]) {
+                wins++;
+            } else {
+                losses++;
+            }
+            if (winner == 1) xWins++;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < match.jobs; t++) {
+        workers.push_back(std::thread(worker));
+    }
+    worker();
+    for (int t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    // the score of every game is 1, 1/2 or 0; its standard error bounds the Elo difference
+    int games = match.games;
+    double score = (wins + 0.5 * draws) / games;
+    double variance = (wins * (1 - score) * (1 - score) + draws * (0.5 - score) * (0.5 - score)
+                       + losses * score * score) / games;
+    double margin = 1.96 * sqrt(variance / games);
+    cout << "Match: " << engineNames[match.engines[0]] << " vs " << engineNames[match.engines[1]] << " | Board: "
+         << match.rows << 'x' << match.columns << " connect " << match.connect << " | Games: " << games
+         << " | Threads: " << match.jobs << endl;
+    cout << "Results of " << engineNames[match.engines[0]] << ": " << wins << " wins, " << draws << " draws, "
+         << losses << " losses (" << setprecision(3) << 100 * score << "%)" << endl;
+    cout << "Wins of x: " << xWins << " | Wins of o: " << games - draws - xWins << endl;
+    if (score <= 0 || score >= 1) {
+        cout << "Elo difference: unbounded (one engine won every game)" << endl;
+    } else {
+        double low = std::max(score - margin, 0.5 / games);
+        double high = std::min(score + margin, 1 - 0.5 / games);
+        cout << "Elo difference: " << fixed << setprecision(0) << eloDifference(score) << " +/- "
+             << (eloDifference(high) - eloDifference(low)) / 2 << endl;
+    }
+    cout << fixed << setprecision(1) << "Time: " << seconds << " s | Games per second: "
+         << setprecision(2) << games / seconds << endl;
+    cout.unsetf(std::ios::fixed);
+}
+
+// this function plays a sequence of moves in the notation of columnOf, the side to move first
+// over tells whether the last move won the game
+// returns 0, or the number (from 1) of the first move that is illegal; pos then holds the moves before it
+int playMoves(Position& pos, const std::string& moves, bool& over) {
+    for (int i = 0; i < moves.size(); i++) {
+        int col = columnOf(moves[i]) - 1;
+        if (over || col < 0 || col >= pos.shape->columns || !canDrop(pos, col)) return i + 1;
+        int player = sideToMove(pos);
+        int bit = drop(pos, player, col);
+        over = (check(pos, player, bit) == won);
+    }
+    return 0;
+}
+
+// this function counts the move sequences of length depth from pos (perft), player is the side to move
+// a won game is not continued; terminal = false leaves out the sequences that end in a won or full position
+// the moves are generated from pos.legal and checked with the whole-board check, like in the playouts
+uint64_t perft(Position& pos, int player, int depth, bool terminal) {
+    uint64_t count = 0;
+    for (uint32_t legal = pos.legal; legal != 0; legal &= legal - 1) {
+        int col = __builtin_ctz(legal);
+        drop(pos, player, col);
+        bool over = (check(pos, player) == won);
+        if (depth == 1) {
+            if (terminal || !(over || isFull(pos))) count++;
+        } else if (!over) {
+            count += perft(pos, 1 - player, depth - 1, terminal);
+        }
+        undo(pos, player, col);
+    }
+    return count;
+}
+
+// this function replaces level by the distinct positions one move later, transpositions counted once
+// the children are sorted and deduplicated by the discs of both players; won and full positions are dropped
+// returns the number of distinct children, with the won and full ones only when terminal is true
+uint64_t expandLevel(std::vector<Position>& level, bool terminal) {
+    std::vector<Position> next;
+    for (int i = 0; i < level.size(); i++) {
+        int player = sideToMove(level[i]);
+        for (uint32_t legal = level[i].legal; legal != 0; legal &= legal - 1) {
+            next.push_back(level[i]);
+            drop(next.back(), player, __builtin_ctz(legal));
+        }
+    }
+    std::sort(next.begin(), next.end(), [](const Position& a, const Position& b) {
+        return a.stones[0] != b.stones[0] ? a.stones[0] < b.stones[0] : a.stones[1] < b.stones[1];
+    });
+    next.erase(std::unique(next.begin(), next.end(), [](const Position& a, const Position& b) {
+        return a.stones[0] == b.stones[0] && a.stones[1] == b.stones[1];
+    }), next.end());
+    
+    // only the positions still in play are kept
+    uint64_t count = next.size();
+    level.clear();
+    for (int i = 0; i < next.size(); i++) {
+        if (check(next[i], 1 - sideToMove(next[i])) == won || isFull(next[i])) {
+            if (!terminal) count--;
+        } else {
+            level.push_back(next[i]);
+        }
+    }
+    return count;
+}
+
+// this function counts the distinct positions after 1 to depth moves from pos (see expandLevel)
+// the memory grows with the number of positions of the widest level
+// terminal = false leaves out the won and full positions (they are never expanded)
+// returns the counts of the levels 1 to depth
+std::vector<uint64_t> perftUnique(const Position& pos, int depth, bool terminal) {
+    std::vector<uint64_t> counts;
+    std::vector<Position> level(1, pos);
+    for (int d = 1; d <= depth; d++) {
+        counts.push_back(expandLevel(level, terminal));
+    }
+    return counts;
+}
+
+// this function prints the perft counts of pos for the depths 1 to depth with their time and positions per second
+// unique counts distinct positions (perftUnique) instead of move sequences (perft)
+void perftReport(const Position& pos, int depth, bool unique, bool terminal) {
+    std::vector<uint64_t> counts;
+    std::vector<double> times;
+    if (unique) {
+        // the levels are only timed together
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        counts = perftUnique(pos, depth, terminal);
+        times.assign(depth, 0);
+        times[depth - 1] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    } else {
+        Position root = pos;
+        for (int d = 1; d <= depth; d++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            counts.push_back(perft(root, sideToMove(root), d, terminal));
+            times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    
+    cout << "Perft: " << pos.shape->rows << 'x' << pos.shape->columns << " connect " << pos.shape->connect
+         << " | " << (unique ? "distinct positions" : "move sequences")
+         << (terminal ? " (with" : " (without") << " won and full positions)" << endl;
+    uint64_t total = 0;
+    for (int d = 0; d < depth; d++) {
+        total += counts[d];
+        cout << "Depth: " << d + 1 << " | Count: " << counts[d];
+        if (times[d] > 0) {
+            cout << " | Time: " << (unsigned long) times[d] << " ms | Positions/s: "
+                 << (unsigned long) ((unique ? total : counts[d]) * 1000.0 / times[d]);
+        }
+        cout << endl;
+    }
+}
+
+// this function maps an opening book file into memory, replacing the book loaded before
+// the file is written by makeBook on a machine with the same byte order
+// returns false (book stays empty) when the file cannot be read or is not a book
+bool loadBook(OpeningBook& book, const char* path) {
+    closeBook(book);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(BookHeader)) {
+        close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    
+    const BookHeader* header = (const BookHeader*) map;
+    if (memcmp(header->magic, "C4BK", 4) != 0
+        || (size_t) info.st_size != sizeof(BookHeader) + (size_t) header->count * sizeof(BookEntry)) {
+        munmap(map, info.st_size);
+        return false;
+    }
+    book.map = map;
+    book.length = info.st_size;
+    book.header = header;
+    book.entries = (const BookEntry*) (header + 1);
+    return true;
+}
+
+// this function unmaps the book loaded by loadBook
+void closeBook(OpeningBook& book) {
+    if (book.map != nullptr) munmap(book.map, book.length);
+    book = OpeningBook();
+}
+
+// this function looks up pos in the book by binary search
+// returns the book column number, 0 when the position is not in the book or the book is for another board
+int probeBook(const OpeningBook& book, const Position& pos) {
+    const BookHeader* header = book.header;
+    const Shape& shape = *pos.shape;
+    if (header == nullptr || header->rows != shape.rows || header->columns != shape.columns
+        || header->connect != shape.connect || pos.moves >= header->plies) return 0;
+    
+    uint64_t key = canonicalKey(pos);
+    const BookEntry* end = book.entries + header->count;
+    const BookEntry* entry = std::lower_bound(book.entries, end, key, [](const BookEntry& e, uint64_t key) {
+        return e.key < key;
+    });
+    if (entry == end || entry->key != key) return 0;
+    int col = canonicalColumn(pos, entry->move);
+    return canDrop(pos, col) ? col + 1 : 0;
+}
+
+// this function writes an opening book for every position with fewer than plies discs on the board
+// the moves are chosen by the alpha-beta solver with config's budget on jobs threads
+// the threads share one transposition table, as the positions of the book have most of their subtrees in common
+// returns false when the file cannot be written
+bool makeBook(const char* path, const Shape& shape, int plies, const SearchConfig& config, int jobs) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::vector<int> > grid(shape.rows, std::vector<int>(shape.columns, 2));
+    std::vector<Position> level(1, toPosition(shape, grid));
+    std::vector<Position> positions;
+    for (int d = 0; d < plies && !level.empty(); d++) {
+        positions.insert(positions.end(), level.begin(), level.end());
+        if (d + 1 < plies) expandLevel(level, false);
+    }
+    // a position and its mirror image share one entry
+    std::sort(positions.begin(), positions.end(), [](const Position& a, const Position& b) {
+        return canonicalKey(a) < canonicalKey(b);
+    });
+    positions.erase(std::unique(positions.begin(), positions.end(), [](const Position& a, const Position& b) {
+        return canonicalKey(a) == canonicalKey(b);
+    }), positions.end());
+    
+    std::vector<BookEntry> entries(positions.size());
+    std::atomic<int> next{0};
+    std::atomic<int> done{0};
+    std::mutex progress;
+    TranspositionTable table;
+    resizeTable(table, config.tableMB, config.tableReplacement);
+    auto worker = [&]() {
+        SearchConfig search = config;
+        search.verbose = false;
+        search.parallel = sequential;  // the jobs are the threads
+        for (int i = next++; i < positions.size(); i = next++) {
+            SearchStats stats;
+            int move = alphaBeta(positions[i], search, table, stats);
+            entries[i].key = canonicalKey(positions[i]);
+            entries[i].score = stats.score;
+            entries[i].move = canonicalColumn(positions[i], move - 1);
+            entries[i].depth = std::min(stats.depth, 255);
+            entries[i].reserved = 0;
+            int count = ++done;
+            if (count % std::max(1, (int) positions.size() / 10) == 0) {
+                std::lock_guard<std::mutex> lock(progress);
+                cout << "Book: " << count << " of " << positions.size() << " positions" << endl;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < jobs; t++) {
+        workers.push_back(std::thread(worker));
+    }
+    worker();
+    for (int t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    std::sort(entries.begin(), entries.end(), [](const BookEntry& a, const BookEntry& b) {
+        return a.key < b.key;
+    });
+    
+    BookHeader header;
+    memcpy(header.magic, "C4BK", 4);
+    header.rows = shape.rows;
+    header.columns = shape.columns;
+    header.connect = shape.connect;
+    header.plies = plies;
+    header.count = entries.size();
+    header.reserved = 0;
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) entries.data(), entries.size() * sizeof(BookEntry));
+    if (!file) return false;
     
-    return tempChild;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    cout << "Book: " << entries.size() << " positions up to " << plies - 1 << " discs written to " << path
+         << " in " << setprecision(3) << seconds << " s" << endl;
+    return true;
 }
 
-// this function recursively back-propagates the leaf node's heuristic value throughout the tree
-void backPropagate(Node* leaf, int leafvalue) {
-    int l = leafvalue;
-    if (leaf->parent != NULL) {
-        switch(l) {
-            case 1 :
-                leaf->parent->value++;
+// this function times an operation: body(n) runs it n times, n doubles until a run takes 200 ms
+// operations receives the n of the last run
+// returns the nanoseconds per operation of the last run
+double timeOperation(const std::function<void(unsigned long)>& body, unsigned long& operations) {
+    double elapsed = 0;
+    for (operations = 1024; ; operations *= 2) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        body(operations);
+        elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed >= 2e8) break;
+    }
+    return elapsed / operations;
+}
+
+// this function measures the primitives of the search engines on one board and prints one JSON object per line
+// drop, check and winningCells run on a fixed set of positions from random games (seeded by seed);
+// rollout and rollout_batch play from the empty board (rollout_tactical and rollout_batch_tactical by tacticalRollouts);
+// addNodes expands a root and backPropagate walks a path of rows*columns/2 nodes; mcts is a whole
+// MonteCarloTreeSearch decision on the empty board with config's budget (without tree reuse, the ns per op are per
+// decision)
+void benchmark(int rows, int columns, int connect, const SearchConfig& config, uint64_t seed) {
+    Shape shape;
+    initShape(shape, rows, columns, connect);
+    std::vector<std::vector<int> > grid(rows, std::vector<int>(columns, 2));
+    Position empty = toPosition(shape, grid);
+    Rng rng;
+    seedRng(rng, seed);
+    volatile uint64_t sink = 0;  // keeps the compiler from removing the measured work
+    
+    // positions from random games, each with a column that has space and the bit of its top disc
+    const int SAMPLES = 256;
+    std::vector<Position> samples;
+    std::vector<int> columnOfSample;
+    std::vector<int> bitOfSample;
+    while (samples.size() < SAMPLES) {
+        Position pos = empty;
+        int length = randomBelow(rng, rows * columns);
+        int bit = -1;
+        for (int i = 0; i < length && !isFull(pos); i++) {
+            int player = sideToMove(pos);
+            bit = drop(pos, player, randomLegal(pos, rng));
+            if (check(pos, player, bit) == won) break;
+        }
+        if (bit < 0 || isFull(pos)) continue;
+        samples.push_back(pos);
+        columnOfSample.push_back(randomLegal(pos, rng));
+        bitOfSample.push_back(bit);
+    }
+    
+    auto report = [&](const char* name, double nanoseconds, unsigned long operations) {
+        cout << "{\"benchmark\":\"" << name << "\",\"rows\":" << rows << ",\"columns\":" << columns
+             << ",\"connect\":" << connect << ",\"operations\":" << operations << ",\"ns_per_op\":"
+             << setprecision(4) << nanoseconds << ",\"ops_per_second\":" << setprecision(6) << 1e9 / nanoseconds
+             << "}" << endl;
+    };
+    unsigned long operations;
+    double ns;
+    
+    // drop and undo of one disc
+    ns = timeOperation([&](unsigned long n) {
+        for (unsigned long i = 0; i < n; i++) {
+            Position& pos = samples[i % SAMPLES];
+            int player = sideToMove(pos);
+            sink += drop(pos, player, columnOfSample[i % SAMPLES]);
+            undo(pos, player, columnOfSample[i % SAMPLES]);
+        }
+    }, operations);
+    report("drop", ns, operations);
+    
+    // win check of the whole board (used by the playouts)
+    ns = timeOperation([&](unsigned long n) {
+        for (unsigned long i = 0; i < n; i++) {
+            Position& pos = samples[i % SAMPLES];
+            sink += check(pos, 1 - sideToMove(pos));
+        }
+    }, operations);
+    report("check", ns, operations);
+    
+    // win check of the lines through the last disc (used by the interactive modes)
+    ns = timeOperation([&](unsigned long n) {
+        for (unsigned long i = 0; i < n; i++) {
+            Position& pos = samples[i % SAMPLES];
+            sink += check(pos, 1 - sideToMove(pos), bitOfSample[i % SAMPLES]);
+        }
+    }, operations);
+    report("check_last", ns, operations);
+    
+    ns = timeOperation([&](unsigned long n) {
+        for (unsigned long i = 0; i < n; i++) {
+            Position& pos = samples[i % SAMPLES];
+            sink += winningCells(pos, sideToMove(pos));
+        }
+    }, operations);
+    report("winningCells", ns, operations);
+    
+    // random playout from the empty board, uniform and tactical
+    for (int tactical = 0; tactical < 2; tactical++) {
+        ns = timeOperation([&](unsigned long n) {
+            for (unsigned long i = 0; i < n; i++) {
+                Position pos = empty;
+                sink += rollout(pos, 1, rng, tactical);
+            }
+        }, operations);
+        report(tactical ? "rollout_tactical" : "rollout", ns, operations);
+    }
+    
+    // random playouts from the empty board in lockstep lanes, the ns per op are per playout
+    for (int tactical = 0; tactical < 2; tactical++) {
+        ns = timeOperation([&](unsigned long n) {
+            Playouts playouts;
+            rolloutBatch(empty, 1, rng, (int) n, playouts, tactical);
+            sink += playouts.wins[1];
+        }, operations);
+        report(tactical ? "rollout_batch_tactical" : "rollout_batch", ns, operations);
+    }
+    
+    // expansion of a root; the pool is reset whenever it is full
+    NodePool pool;
+    ns = timeOperation([&](unsigned long n) {
+        createTree(pool, 1 << 16, empty);
+        for (unsigned long i = 0; i < n; i++) {
+            if (!addNodes(pool, 0, empty, false)) {
+                createTree(pool, 1 << 16, empty);
+                addNodes(pool, 0, empty, false);
+            }
+        }
+        sink += pool.size;
+    }, operations);
+    report("addNodes", ns, operations);
+    
+    // back-propagation along a path from the root through the first child of each level
+    createTree(pool, 1 << 16, empty);
+    Position pos = empty;
+    uint32_t leaf = 0;
+    for (int level = 0; level < rows * columns / 2; level++) {
+        addNodes(pool, leaf, pos, false);
+        leaf = pool.nodes[leaf].firstChild;
+        drop(pos, pool.nodes[leaf].player, pool.nodes[leaf].column - 1);
+    }
+    Playouts results[3];  // 'o' wins, 'x' wins, a draw
+    results[0].wins[0] = 1;
+    results[1].wins[1] = 1;
+    results[2].draws = 1;
+    ns = timeOperation([&](unsigned long n) {
+        for (unsigned long i = 0; i < n; i++) {
+            backPropagate(pool, leaf, results[i % 3], 0);
+        }
+        sink += pool.nodes[0].visits;
+    }, operations);
+    report("backPropagate", ns, operations);
+    
+    // whole decisions from the empty board
+    SearchConfig decision = config;
+    decision.verbose = false;
+    decision.reuseTree = false;
+    decision.ponder = false;
+    MCTSState state;
+    SearchStats stats;
+    operations = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (operations < 3 || elapsed < 1e9) {
+        Position root = empty;
+        sink += MonteCarloTreeSearch(root, decision, state, nullptr, rng, stats);
+        operations++;
+        elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+    report("mcts", elapsed / operations, operations);
+}
+
+// this function implements Monte Carlo Tree Search during runtime against human player
+// every iteration selects a path by UCB1, expands one node, simulates a random playout and backpropagates the result
+// proven wins and losses are backpropagated minimax-style (see proveNode); the search ends once the root is proven
+// config sets the exploration constant, the time and playout budget, the size of the tree and the parallelization
+// state holds the trees between moves: the subtree of pos is reused, and pondering continues from the chosen move
+// table (optional) is shared by all threads: a leaf whose position is proven in it is settled without a search,
+// and the proofs of the search are stored in it for the transpositions of later iterations and searches
+// rng seeds a separate generator for every thread
+// stats receives the playouts of this search, the table probes and hits and the win rate of the chosen column (1000, 500 or 0 once it is proven)
+// returns the column number with the most visits, preferring proven wins and avoiding proven losses
+int MonteCarloTreeSearch(Position& pos, const SearchConfig& config, MCTSState& state, TranspositionTable* table, Rng& rng, SearchStats& stats) {
+    Position tempPos = pos;
+    int max;
+    int choice;
+    int threads = (config.parallel == sequential) ? 1 : config.threads;
+    std::vector<NodePool>& pools = state.pools;
+    std::vector<std::thread> workers;
+    unsigned long reused = 0;
+    unsigned long before = 0;   // nodes in the trees before the search
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    int computerChoice = determineComputerChoice(pos)[0];
+    
+    // the root holds the current position; the human made the last move
+    // a tree that reaches the current position keeps the statistics of that subtree
+    stopPondering(state);
+    if (config.parallel == rootParallel) {
+        pools.resize(threads);
+    }
+    // a tree of another capacity (the pools of a server worker are lent to every session) starts over, and so does
+    // one that a tree-parallel search overfilled (see reuseTree)
+    for (int t = 0; t < pools.size(); t++) {
+        if (pools[t].nodes.size() != config.maxNodes || pools[t].size > pools[t].nodes.size()) {
+            destroyTree(pools[t]);
+        }
+        if (config.reuseTree && reuseTree(pools[t], pos)) {
+            reused += pools[t].nodes[0].visits;
+        } else {
+            createTree(pools[t], config.maxNodes, pos);
+        }
+        before += pools[t].size;
+        pools[t].peak = pools[t].size;
+    }
+    
+    // Monte Carlo Tree Search Algorithm
+    // all threads draw their playouts from one budget until it runs out
+    if (table != nullptr) newSearch(*table);
+    Budget budget;
+    startBudget(budget, config);
+    stats.prepareMs = std::chrono::duration<double, std::milli>(budget.start - start).count();
+    std::vector<uint64_t> seeds(threads + 1);
+    std::vector<SearchStats> threadStats(threads);
+    for (int t = 0; t <= threads; t++) {
+        seeds[t] = nextRandom(rng);
+    }
+    for (int t = 1; t < threads; t++) {
+        NodePool& pool = (config.parallel == rootParallel) ? pools[t] : pools[0];
+        workers.push_back(std::thread(searchTree, std::ref(pos), std::ref(pool), 0, std::cref(config), table,
+                                      std::ref(budget), config.parallel == treeParallel, seeds[t], std::ref(threadStats[t])));
+    }
+    searchTree(pos, pools[0], 0, config, table, budget, config.parallel == treeParallel, seeds[0], threadStats[0]);
+    for (int t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    std::chrono::steady_clock::time_point searched = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double, std::milli>(searched - budget.start).count();
+    
+    // merge the root statistics of every tree by column
+    unsigned long visits[MAX_COLUMNS] = {0};
+    unsigned long score[MAX_COLUMNS] = {0};
+    int proof[MAX_COLUMNS] = {0};   // a proof holds in every tree that has one
+    bool proven = false;
+    for (int t = 0; t < pools.size(); t++) {
+        Node& root = pools[t].nodes[0];
+        for (uint32_t i = root.firstChild; i < root.firstChild + root.childCount; i++) {
+            Node& child = pools[t].nodes[i];
+            visits[child.column - 1] += child.visits;
+            score[child.column - 1] += child.score;
+            if (child.proof != unproven) {
+                proof[child.column - 1] = child.proof;
+                proven = true;
+            }
+        }
+    }
+    
+    // the trees only shrink when they are pruned, so their size now plus the pruned nodes is what was added
+    unsigned long playouts = 0;
+    unsigned long used = 0;
+    unsigned long peak = 0;    // nodes in use at the fullest point of each tree, before pruneTree cut it
+    double depthSum = 0;
+    stats.depth = 0;
+    for (int t = 0; t < pools.size(); t++) {
+        playouts += pools[t].nodes[0].visits;
+        used += std::min((unsigned long) pools[t].size, (unsigned long) pools[t].nodes.size());
+        peak += std::min((unsigned long) std::max(pools[t].peak, pools[t].size), (unsigned long) pools[t].nodes.size());
+    }
+    for (int t = 0; t < threads; t++) {
+        stats.depth = std::max(stats.depth, threadStats[t].depth);
+        depthSum += threadStats[t].averageDepth * threadStats[t].iterations;
+        stats.pruned += threadStats[t].pruned;
+        stats.probes += threadStats[t].probes;
+        stats.hits += threadStats[t].hits;
+    }
+    stats.iterations = playouts - reused;
+    stats.reused = reused;
+    stats.nodes = used + stats.pruned - before;
+    stats.memory = peak * sizeof(Node);
+    stats.averageDepth = (stats.iterations > 0) ? depthSum / stats.iterations : 0;
+    stats.searchMs = elapsed;
+    stats.rate = stats.iterations * 1000.0 / std::max(elapsed, 1e-3);
+    if (config.verbose) {
+        cout << "Monte Carlo Tree Search Mode: " << endl;
+        cout << "Playouts: " << playouts - reused << " in " << (int) elapsed << " ms" << endl;
+        if (reused > 0) {
+            cout << "Reused Playouts: " << reused << endl;
+        }
+        cout << "Tree Depth: " << stats.depth << " | Average Leaf Depth: " << setprecision(3) << stats.averageDepth << endl;
+        if (stats.probes > 0) {
+            cout << "Table Hits: " << stats.hits << '/' << stats.probes << endl;
+        }
+        cout << "Win Rates: |";
+        for (int i = 0; i < pos.shape->columns; i++) {
+            if (visits[i] > 0) cout << setprecision(3) << score[i] / (2.0 * visits[i]) << '|';
+        }
+        cout << endl;
+        cout << "Visits: |";
+        for (int i = 0; i < pos.shape->columns; i++) {
+            if (visits[i] > 0) cout << visits[i] << '|';
+        }
+        cout << endl;
+        if (proven) {
+            cout << "Proven Results: |";
+            for (int i = 0; i < pos.shape->columns; i++) {
+                if (visits[i] > 0) cout << "-LDW"[proof[i]] << '|';
+            }
+            cout << endl;
+        }
+        cout << "Column Numbers: |";
+        for (int i = 0; i < pos.shape->columns; i++) {
+            if (visits[i] > 0) cout << i + 1 << '|';
+        }
+        cout << endl;
+    }
+    
+    // a proven win is played at once and a proven loss only when every column loses;
+    // otherwise the most visited column will be chosen (UCB1 concentrates visits on the strongest move)
+    max = -1; // initialize max
+    int rank = -1;
+    choice = 0;
+    for (int i = 0; i < pos.shape->columns; i++) {
+        if (!canDrop(pos, i)) continue;
+        int columnRank = (proof[i] == provenWin) ? 2 : (proof[i] == provenLoss) ? 0 : 1;
+        if (columnRank > rank || (columnRank == rank && (long) visits[i] > max)) {
+            rank = columnRank;
+            max = visits[i];
+            choice = i + 1;
+        }
+    }
+    if (proof[choice - 1] != unproven) {
+        stats.score = 500 * (proof[choice - 1] - provenLoss);
+    } else {
+        stats.score = (visits[choice - 1] > 0) ? (int) (500 * score[choice - 1] / visits[choice - 1]) : 0;
+    }
+    stats.finishMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - searched).count();
+    
+    // ponder on the position after the chosen move until the next search
+    if (config.ponder) {
+        drop(tempPos, computerChoice, choice - 1);
+        if (check(tempPos, computerChoice) != won && !isFull(tempPos) && reuseTree(pools[0], tempPos)) {
+            state.stop = false;
+            state.ponder = std::thread(ponderTree, std::ref(state), std::cref(config), seeds[threads]);
+        }
+    }
+    
+    return choice;
+}
+
+// this function runs Monte Carlo Tree Search iterations on one tree until the budget runs out
+// it is the body of every search thread; shared is true when other threads work on the same tree
+// playouts are claimed from the budget in small batches, so the clock is read once per batch
+// every iteration plays config.leafPlayouts of them from its leaf (fewer at the end of a batch)
+// a full tree is pruned (see pruneTree) before the next iteration when config.recycle is set and the tree is not shared
+// the budget is stopped for all threads as soon as the root is proven
+// seed initializes the thread's own generator; table (optional) is probed and updated by mcts and backPropagate
+// stats receives the playouts of this thread, its table probes and hits, the nodes it pruned and the maximum and mean depth of the leaves
+void searchTree(Position& pos, NodePool& pool, uint32_t root, const SearchConfig& config, TranspositionTable* table, Budget& budget, bool shared, uint64_t seed, SearchStats& stats) {
+    Playouts playouts;
+    int depth;
+    int count;
+    uint32_t leaf;
+    unsigned long batch;
+    unsigned long iterations = 0;
+    unsigned long depthSum = 0;
+    int maxDepth = 0;
+    int virtualLoss = shared ? config.virtualLoss : 0;
+    bool recycle = config.recycle && !shared;  // a shared tree cannot move under the other threads; it stops growing
+    unsigned long pruned = 0;
+    Rng rng;
+    seedRng(rng, seed);
+    playouts.table = table;
+    while ((batch = claimNodes(budget, 256)) > 0) {
+        for (unsigned long i = 0; i < batch; i += count) {
+            if (recycle && pool.size + MAX_COLUMNS > pool.nodes.size()) {
+                unsigned long freed = pruneTree(pool);
+                pruned += freed;
+                recycle = freed >= MAX_COLUMNS;  // a tiny pool cannot be helped
+            }
+            // a solved root ends the search of every thread
+            if ((shared ? __atomic_load_n(&pool.nodes[root].proof, __ATOMIC_RELAXED) : pool.nodes[root].proof) != unproven) {
+                budget.stopped = true;
                 break;
-            case -1 :
-                leaf->parent->value--;
+            }
+            count = (int) std::min((unsigned long) config.leafPlayouts, batch - i);
+            leaf = mcts(pos, pool, root, config, count, playouts, shared, rng);
+            depth = backPropagate(pool, leaf, playouts, virtualLoss);
+            depthSum += (unsigned long) depth * count;
+            if (depth > maxDepth) maxDepth = depth;
+            iterations += count;
+        }
+    }
+    stats.iterations = iterations;
+    stats.pruned = pruned;
+    stats.probes = playouts.probes;
+    stats.hits = playouts.hits;
+    stats.depth = maxDepth;
+    stats.averageDepth = (iterations > 0) ? (double) depthSum / iterations : 0;
+}
+
+// this function starts the clock of a search budget from the limits in config
+void startBudget(Budget& budget, const SearchConfig& config) {
+    budget.timed = config.timeLimit > 0;
+    budget.start = std::chrono::steady_clock::now();
+    budget.deadline = budget.start + std::chrono::milliseconds(config.timeLimit);
+    budget.nodeLimit = config.nodeLimit;
+    budget.nodes = 0;
+    budget.stopped = false;
+}
+
+// this function hands out up to count more nodes of the budget
+// returns how many nodes may be searched, 0 once the deadline has passed or the node budget is used up
+unsigned long claimNodes(Budget& budget, unsigned long count) {
+    if (budget.stopped.load(std::memory_order_relaxed)) return 0;
+    if (budget.timed && std::chrono::steady_clock::now() >= budget.deadline) {
+        budget.stopped = true;
+        return 0;
+    }
+    unsigned long before = budget.nodes.fetch_add(count, std::memory_order_relaxed);
+    if (budget.nodeLimit > 0) {
+        if (before >= budget.nodeLimit) {
+            budget.stopped = true;
+            return 0;
+        }
+        return std::min(count, budget.nodeLimit - before);
+    }
+    return count;
+}
+
+// this function searches the tree of pools[0] until stopPondering is called, the root is proven or the tree is full
+// (and cannot be pruned)
+// it runs on its own thread while the human chooses a move
+void ponderTree(MCTSState& state, const SearchConfig& config, uint64_t seed) {
+    NodePool& pool = state.pools[0];
+    Playouts playouts;
+    uint32_t leaf;
+    Rng rng;
+    seedRng(rng, seed);
+    while (!state.stop.load(std::memory_order_relaxed) && pool.nodes[0].proof == unproven) {
+        if (pool.size + MAX_COLUMNS > pool.nodes.size() && (!config.recycle || pruneTree(pool) < MAX_COLUMNS)) break;
+        leaf = mcts(pool.root, pool, 0, config, config.leafPlayouts, playouts, false, rng);
+        backPropagate(pool, leaf, playouts, 0);
+    }
+}
+
+// this function stops the pondering thread, if there is one, and waits for it
+void stopPondering(MCTSState& state) {
+    state.stop = true;
+    if (state.ponder.joinable()) {
+        state.ponder.join();
+    }
+}
+
+// this function prepares the pool for a new tree of at most capacity Nodes
+// the storage is only allocated on first use or when the capacity changes, so the pool never holds more
+// pos is the root position; its last move was made by the opponent of the side to move
+// returns the index of the root Node
+uint32_t createTree(NodePool& pool, unsigned long capacity, const Position& pos) {
+    if (pool.nodes.size() != capacity) {
+        std::vector<Node>(capacity).swap(pool.nodes);
+        std::vector<uint32_t>().swap(pool.relocation);
+    }
+    pool.size = 1;
+    pool.root = pos;
+    pool.rows = pos.shape->rows;
+    pool.columns = pos.shape->columns;
+    pool.connect = pos.shape->connect;
+    Node& root = pool.nodes[0];
+    root.score = 0;
+    root.visits = 0;
+    root.amafScore = 0;
+    root.amafVisits = 0;
+    root.parent = NO_NODE;
+    root.firstChild = NO_NODE;
+    root.childCount = 0;
+    root.column = 0;
+    root.cell = 0;
+    root.player = 1 - sideToMove(pos);
+    root.proof = unproven;
+    return 0;
+}
+
+// this function makes the node of pos the new root of the tree, keeping its statistics
+// follows the discs added since pool.root through the tree, then moves that subtree to the front of the pool;
+// no second pool is needed, so a tree never takes more than its capacity
+// a tree that a tree-parallel search overfilled (addNodes reserves room before it checks it) holds stale nodes in
+// the gap it leaves, and is not reused
+// returns false if pos cannot be reached from the root inside the tree; the tree is left unchanged
+bool reuseTree(NodePool& pool, const Position& pos) {
+    if (pool.size == 0 || pool.size > pool.nodes.size() || pool.rows != pos.shape->rows || pool.columns != pos.shape->columns
+        || pool.connect != pos.shape->connect || pool.root.moves > pos.moves) return false;
+    
+    Position current = pool.root;
+    current.shape = pos.shape;
+    uint32_t node = 0;
+    int rows = pos.shape->rows;
+    int columns = pos.shape->columns;
+    int mirror = pos.shape->mirror;
+    bool mirrored = false;  // the path went on through the mirror image of a symmetric position
+    while (current.moves < pos.moves) {
+        // the column whose next cell holds a disc of the side to move
+        int player = sideToMove(current);
+        int col = -1;
+        for (int c = 0; c < pos.shape->columns; c++) {
+            if (current.height[c] < pos.height[c] && ((pos.stones[player] >> (c*rows + current.height[c])) & 1)) {
+                if (col >= 0) return false;  // the order of the moves is ambiguous
+                col = c;
+            }
+        }
+        if (col < 0) return false;
+        Node& n = pool.nodes[node];
+        if (n.firstChild == NO_NODE || n.firstChild == EXPANDING) return false;
+        // the children of a symmetric position only cover the left half; the right half is its mirror image
+        int treeColumn = mirrored ? columns - 1 - col : col;
+        uint32_t next = NO_NODE;
+        for (int pass = 0; pass < 2 && next == NO_NODE; pass++) {
+            for (uint32_t i = n.firstChild; i < n.firstChild + n.childCount; i++) {
+                if (pool.nodes[i].column == treeColumn + 1) next = i;
+            }
+            if (next != NO_NODE || current.key != current.mirrorKey) break;
+            mirrored = !mirrored;
+            treeColumn = columns - 1 - treeColumn;
+        }
+        if (next == NO_NODE) return false;
+        drop(current, player, col);
+        node = next;
+    }
+    if (current.stones[0] != pos.stones[0] || current.stones[1] != pos.stones[1]) return false;
+    if (node == 0) {
+        pool.root = pos;
+        return true;
+    }
+    
+    // keep the subtree of node: a node is kept when its parent is, and a parent always lies before its children,
+    // so the kept nodes slide down in place in one pass, as in pruneTree, with node landing on index 0
+    // a subtree reached through a mirror image is mirrored back into the orientation of pos
+    if (pool.relocation.size() != pool.nodes.size()) {
+        std::vector<uint32_t>(pool.nodes.size()).swap(pool.relocation);
+    }
+    uint32_t size = 0;
+    for (uint32_t i = node; i < pool.size; i++) {
+        Node n = pool.nodes[i];
+        if (i == node) {
+            n.parent = NO_NODE;
+        } else {
+            if (n.parent < node || pool.relocation[n.parent] == NO_NODE) {
+                pool.relocation[i] = NO_NODE;
+                continue;
+            }
+            uint32_t parent = pool.relocation[n.parent];
+            if (pool.nodes[parent].firstChild == i) pool.nodes[parent].firstChild = size;
+            n.parent = parent;
+        }
+        if (n.firstChild == EXPANDING) n.firstChild = NO_NODE;
+        if (mirrored) {
+            n.column = columns + 1 - n.column;
+            n.cell = mirror - n.cell + 2*(n.cell % rows);
+        }
+        pool.relocation[i] = size;
+        pool.nodes[size++] = n;
+    }
+    pool.size = size;
+    pool.root = pos;
+    return true;
+}
+
+// this function deletes the entire tree
+// the Nodes stay allocated for the next search, so teardown is a single reset
+void destroyTree(NodePool& pool) {
+    pool.size = 0;
+}
+
+// this function makes room in a full tree by cutting the subtrees below its least visited nodes
+// every expanded node but the root with fewer visits than a threshold becomes a leaf again and keeps its own
+// statistics; the threshold is the smallest power of two that frees at least half of the tree
+// (a child never has more visits than its parent, so each freed block of children is counted once)
+// the kept nodes slide down in place in their old order: a parent always lies before its children, so the
+// blocks of children stay contiguous and no second pool is needed
+// the pool must not be shared by running threads; the root is node 0
+// returns the number of nodes freed
+unsigned long pruneTree(NodePool& pool) {
+    pool.peak = std::max(pool.peak, pool.size);
+    // freed[b]: nodes in the blocks of children of the expanded nodes with visits in [2^(b-1), 2^b)
+    unsigned long freed[33] = {0};
+    for (uint32_t i = 1; i < pool.size; i++) {
+        Node& n = pool.nodes[i];
+        if (n.firstChild == NO_NODE || n.firstChild == EXPANDING) continue;
+        freed[n.visits == 0 ? 0 : 32 - __builtin_clz(n.visits)] += n.childCount;
+    }
+    int cut = 0;
+    unsigned long total = freed[0];
+    while (cut < 32 && total < pool.size / 2) total += freed[++cut];
+    
+    if (pool.relocation.size() != pool.nodes.size()) {
+        std::vector<uint32_t>(pool.nodes.size()).swap(pool.relocation);
+    }
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < pool.size; i++) {
+        Node n = pool.nodes[i];
+        if (i > 0) {
+            // the parent has been moved already; a cut parent has lost its children
+            uint32_t parent = pool.relocation[n.parent];
+            if (parent == NO_NODE || pool.nodes[parent].firstChild == NO_NODE) {
+                pool.relocation[i] = NO_NODE;
+                continue;
+            }
+            if (pool.nodes[parent].firstChild == i) pool.nodes[parent].firstChild = size;
+            n.parent = parent;
+            bool expanded = n.firstChild != NO_NODE && n.firstChild != EXPANDING;
+            if (expanded && (n.visits == 0 ? 0 : 32 - __builtin_clz(n.visits)) <= cut) {
+                n.firstChild = NO_NODE;
+                n.childCount = 0;
+            }
+        }
+        pool.relocation[i] = size;
+        pool.nodes[size++] = n;
+    }
+    unsigned long pruned = pool.size - size;
+    pool.size = size;
+    return pruned;
+}
+
+// returns the capacity in Nodes of a tree of megabytes, counting the relocation index of pruneTree and reuseTree
+unsigned long treeCapacity(unsigned long megabytes) {
+    return (megabytes << 20) / (sizeof(Node) + sizeof(uint32_t));
+}
+
+// this function adds one child node for every available column to the parent node
+// the children are allocated as one contiguous block
+// shared: the parent is claimed with a compare-and-swap so that only one thread expands it,
+//         the block is published by a release store of firstChild
+// returns false if the pool is full or another thread is expanding the parent (the parent stays a leaf)
+bool addNodes(NodePool& pool, uint32_t parent, const Position& pos, bool shared) {
+    // a move and its mirror image lead to equal positions when pos is symmetric; only the left one is kept
+    uint32_t moves = (pos.key == pos.mirrorKey) ? pos.legal & pos.shape->leftHalf : pos.legal;
+    int count = __builtin_popcount(moves);
+    uint32_t first;
+    
+    if (shared) {
+        uint32_t expected = NO_NODE;
+        if (!__atomic_compare_exchange_n(&pool.nodes[parent].firstChild, &expected, EXPANDING, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return false;
+        }
+        first = __atomic_fetch_add(&pool.size, count, __ATOMIC_RELAXED);
+        // a full pool leaves the parent marked EXPANDING, so it is never claimed again
+        if (first + count > pool.nodes.size()) return false;
+    } else {
+        if (pool.size + count > pool.nodes.size()) return false;
+        first = pool.size;
+        pool.size += count;
+    }
+    
+    int player = 1 - pool.nodes[parent].player;
+    Node* child = &pool.nodes[first];
+    for (uint32_t legal = moves; legal != 0; legal &= legal - 1) {
+        int i = __builtin_ctz(legal);
+        child->score = 0;
+        child->visits = 0;
+        child->amafScore = 0;
+        child->amafVisits = 0;
+        child->parent = parent;
+        child->firstChild = NO_NODE;
+        child->childCount = 0;
+        child->column = i + 1;
+        child->cell = i*pos.shape->rows + pos.height[i];
+        child->player = player;
+        child->proof = unproven;
+        child++;
+    }
+    pool.nodes[parent].childCount = count;
+    if (shared) {
+        __atomic_store_n(&pool.nodes[parent].firstChild, first, __ATOMIC_RELEASE);
+    } else {
+        pool.nodes[parent].firstChild = first;
+    }
+    return true;
+}
+
+// this function proves an expanded node from the proofs of its children (MCTS-Solver, minimax over the replies)
+// the node is a loss for its player as soon as one reply wins; once every reply is proven it is a win if they
+// all lose and a draw otherwise (the replies of a symmetric position only cover its left half, which is enough)
+// shared: the proofs are read and written atomically
+// returns true if the node is proven
+bool proveNode(NodePool& pool, uint32_t node, bool shared) {
+    Node& n = pool.nodes[node];
+    if ((shared ? __atomic_load_n(&n.proof, __ATOMIC_RELAXED) : n.proof) != unproven) return true;
+    uint32_t first = shared ? __atomic_load_n(&n.firstChild, __ATOMIC_ACQUIRE) : n.firstChild;
+    if (first == NO_NODE || first == EXPANDING) return false;
+    
+    int best = provenLoss;  // best proven reply
+    bool open = false;      // some reply is unproven
+    for (uint32_t i = first; i < first + n.childCount; i++) {
+        int proof = shared ? __atomic_load_n(&pool.nodes[i].proof, __ATOMIC_RELAXED) : pool.nodes[i].proof;
+        if (proof == unproven) {
+            open = true;
+        } else if (proof > best) {
+            best = proof;
+        }
+        if (best == provenWin) break;
+    }
+    if (open && best != provenWin) return false;
+    uint8_t proof = provenWin + provenLoss - best;  // the result of the best reply, seen by the node's player
+    if (shared) {
+        __atomic_store_n(&n.proof, proof, __ATOMIC_RELAXED);
+    } else {
+        n.proof = proof;
+    }
+    return true;
+}
+
+// this function reads a table entry as the Proof of the player who moved into pos
+// a win or loss score (of the alpha-beta solver or storeProof) that is exact or bounds the score from the right
+// side proves the position, and so does an exact draw searched to the end of the game
+// returns unproven otherwise
+int entryProof(const TTEntry& entry, const Position& pos) {
+    int cells = pos.shape->rows * pos.shape->columns;
+    if (entry.score >= MATE - cells && entry.flag != upper) return provenLoss;  // the side to move wins
+    if (entry.score <= -(MATE - cells) && entry.flag != lower) return provenWin;
+    if (entry.score == 0 && entry.flag == exact && entry.depth >= cells - pos.moves) return provenDraw;
+    return unproven;
+}
+
+// this function stores the Proof of a node of a tree on root's board in the table, under the key of its position
+// in the terms of the alpha-beta solver: a bound at the slowest win or loss, or an exact draw, at any depth
+void storeProof(TranspositionTable& table, uint64_t key, int proof, const Position& root, unsigned long visits) {
+    int win = MATE - root.shape->rows * root.shape->columns;
+    if (proof == provenWin) {
+        storeTable(table, key, -win, 255, upper, -1, visits);
+    } else if (proof == provenLoss) {
+        storeTable(table, key, win, 255, lower, -1, visits);
+    } else if (proof == provenDraw) {
+        storeTable(table, key, 0, 255, exact, -1, visits);
+    }
+}
+
+// this function runs one iteration of the Monte Carlo Tree Search from the root node
+// selection: descends through expanded nodes by the UCB1 score, unvisited children first, proven children never
+//            (with RAVE, the win rate in the score is blended with the AMAF win rate, see raveEquivalence)
+// expansion: a visited leaf gets children for all available columns
+// simulation: plays count random playouts from the selected node until the game ends
+//             (in lockstep by rolloutBatch when count is above 1)
+// shared: every node on the path receives a virtual loss, removed again by backPropagate
+// a terminal node is proven when it is reached, and a proven node counts its result count times instead of a playout
+// returns the index of the selected node, playouts is set to the count results
+uint32_t mcts(Position& pos, NodePool& pool, uint32_t root, const SearchConfig& config, int count, Playouts& playouts, bool shared, Rng& rng) {
+    Position currentPos = pos;   // a bitboard copy is a few dozen bytes, no heap allocation
+    uint32_t node = root;
+    uint32_t first;
+    uint32_t pending = shared ? config.virtualLoss : 0;  // visits this thread has added to the node
+    uint32_t visits;
+    Node* n;
+    double best;
+    double score;
+    double logVisits;
+    
+    playouts.wins[0] = 0;
+    playouts.wins[1] = 0;
+    playouts.draws = 0;
+    playouts.length = 0;
+    if (playouts.table != nullptr) playouts.keys[0] = canonicalKey(currentPos);
+    playouts.amaf = config.raveEquivalence > 0;
+    if (playouts.amaf) {
+        memset(playouts.amafVisits, 0, sizeof(playouts.amafVisits));
+        memset(playouts.amafPoints, 0, sizeof(playouts.amafPoints));
+    }
+    if (shared) {
+        __atomic_fetch_add(&pool.nodes[root].visits, pending, __ATOMIC_RELAXED);
+    }
+    
+    while (true) {
+        n = &pool.nodes[node];
+        // terminal node: the move into it won or filled the board, so its value is proven at once
+        int proof = shared ? __atomic_load_n(&n->proof, __ATOMIC_RELAXED) : n->proof;
+        if (proof == unproven && node != root) {
+            if (check(currentPos, n->player) == won) {
+                proof = provenWin;
+            } else if (isFull(currentPos)) {
+                proof = provenDraw;
+            }
+            if (shared) {
+                __atomic_store_n(&n->proof, (uint8_t) proof, __ATOMIC_RELAXED);
+            } else {
+                n->proof = proof;
+            }
+        }
+        // a proven node is not searched any further, it scores its value count times
+        if (proof != unproven) {
+            int winner = (proof == provenWin) ? n->player : (proof == provenLoss) ? 1 - n->player : -1;
+            if (winner >= 0) playouts.wins[winner] = count; else playouts.draws = count;
+            if (playouts.amaf) addAmaf(playouts, currentPos.stones[0], currentPos.stones[1], winner, count);
+            return node;
+        }
+        if (isFull(currentPos)) {
+            playouts.draws = count;
+            if (playouts.amaf) addAmaf(playouts, currentPos.stones[0], currentPos.stones[1], -1, count);
+            return node;
+        }
+        
+        // expansion: a leaf is expanded once it has been simulated before
+        first = shared ? __atomic_load_n(&n->firstChild, __ATOMIC_ACQUIRE) : n->firstChild;
+        visits = shared ? __atomic_load_n(&n->visits, __ATOMIC_RELAXED) : n->visits;
+        if (first == NO_NODE || first == EXPANDING) {
+            // a leaf due for expansion may have been proven on another path, by another thread or by an earlier
+            // search; then it is settled instead
+            if (playouts.table != nullptr && first == NO_NODE && visits > pending && node != root) {
+                TTEntry entry;
+                playouts.probes++;
+                if (probeTable(*playouts.table, playouts.keys[playouts.length], entry)) {
+                    playouts.hits++;
+                    proof = entryProof(entry, currentPos);
+                    if (proof != unproven) {
+                        if (shared) {
+                            __atomic_store_n(&n->proof, (uint8_t) proof, __ATOMIC_RELAXED);
+                        } else {
+                            n->proof = proof;
+                        }
+                        continue;
+                    }
+                }
+            }
+            if (first == EXPANDING || (visits <= pending && node != root) || !addNodes(pool, node, currentPos, shared)) {
+                if (count > 1) {
+                    rolloutBatch(currentPos, 1 - n->player, rng, count, playouts, config.rollout == tacticalRollouts);
+                } else {
+                    int winner = rollout(currentPos, 1 - n->player, rng, config.rollout == tacticalRollouts);
+                    if (winner >= 0) playouts.wins[winner]++; else playouts.draws++;
+                    if (playouts.amaf) addAmaf(playouts, currentPos.stones[0], currentPos.stones[1], winner, 1);
+                }
+                return node;
+            }
+            first = n->firstChild;
+        }
+        
+        // selection: UCB1 over the unproven children, an unvisited child is taken right away
+        // RAVE: the AMAF win rate gets the weight beta = sqrt(k / (3 visits + k)), which fades as the child is visited
+        best = -1;
+        uint32_t next = NO_NODE;
+        logVisits = log((double) visits);
+        for (uint32_t i = first; i < first + n->childCount; i++) {
+            if ((shared ? __atomic_load_n(&pool.nodes[i].proof, __ATOMIC_RELAXED) : pool.nodes[i].proof) != unproven) continue;
+            uint32_t childVisits = shared ? __atomic_load_n(&pool.nodes[i].visits, __ATOMIC_RELAXED) : pool.nodes[i].visits;
+            uint32_t childScore = shared ? __atomic_load_n(&pool.nodes[i].score, __ATOMIC_RELAXED) : pool.nodes[i].score;
+            if (childVisits == 0) {
+                next = i;
                 break;
+            }
+            double value = childScore / (2.0 * childVisits);
+            if (config.raveEquivalence > 0) {
+                uint32_t amafVisits = shared ? __atomic_load_n(&pool.nodes[i].amafVisits, __ATOMIC_RELAXED) : pool.nodes[i].amafVisits;
+                uint32_t amafScore = shared ? __atomic_load_n(&pool.nodes[i].amafScore, __ATOMIC_RELAXED) : pool.nodes[i].amafScore;
+                if (amafVisits > 0) {
+                    double beta = sqrt(config.raveEquivalence / (3.0 * childVisits + config.raveEquivalence));
+                    value = (1 - beta) * value + beta * amafScore / (2.0 * amafVisits);
+                }
+            }
+            score = value + config.exploration * sqrt(logVisits / childVisits);
+            if (score > best) {
+                best = score;
+                next = i;
+            }
+        }
+        // every child is proven but the node is not yet (two threads proved the last children at once)
+        if (next == NO_NODE) {
+            if (proveNode(pool, node, shared)) continue;
+            next = first;
+        }
+        node = next;
+        if (shared) {
+            __atomic_fetch_add(&pool.nodes[node].visits, pending, __ATOMIC_RELAXED);
         }
-        backPropagate(leaf->parent, l);
+        drop(currentPos, pool.nodes[node].player, pool.nodes[node].column - 1);
+        if (playouts.table != nullptr) playouts.keys[++playouts.length] = canonicalKey(currentPos);
     }
 }
 
-// determines the computer's choice and human's choice based on current grid
+// this function plays uniformly random moves until the game ends
+// player is the side to move; tactical: the moves follow tacticalRollouts instead (see tacticalRolloutWith)
+// returns the winner (0 or 1), -1 for a draw
+template <class Geometry>
+int rolloutWith(Position& pos, int player, Rng& rng, bool tactical) {
+    int col;
+    
+    if (tactical) return tacticalRolloutWith<Geometry>(pos, player, rng);
+    while (!isFull(pos)) {
+        col = randomLegalWith<Geometry>(pos, rng);
+        dropWith<Geometry>(pos, player, col);
+        if (checkWith<Geometry>(pos, player) == won) return player;
+        player = 1 - player;
+    }
+    return -1;
+}
+
+// this function plays a winning move whenever there is one, else blocks the opponent's winning cell, else a random
+// column, until the game ends
+// the winning cells of both sides are kept as masks (see winningCellsOf); a move only changes those of its player,
+// and a move that wins is always one of them, so no move needs a check
+// player is the side to move
+// returns the winner (0 or 1), -1 for a draw
+template <class Geometry>
+int tacticalRolloutWith(Position& pos, int player, Rng& rng) {
+    int rows = Geometry::rows(pos);
+    int cells = rows * Geometry::columns(pos);
+    uint64_t board = (cells == MAX_CELLS) ? ~0ULL : (1ULL << cells) - 1;
+    uint64_t bottom = 0;   // the bottom cell of every column
+    for (int c = 0; c < Geometry::columns(pos); c++) bottom |= 1ULL << (c*rows);
+    uint64_t threats[2] = {winningCellsOf<Geometry>(pos, pos.stones[0]), winningCellsOf<Geometry>(pos, pos.stones[1])};
+    int col;
+    
+    while (!isFull(pos)) {
+        // the lowest empty cell of every column: above a disc or at the bottom (the cell above a full column is the
+        // bottom of the next one, which is playable or occupied anyway)
+        uint64_t occupied = pos.stones[0] | pos.stones[1];
+        uint64_t playable = ((occupied << 1) | bottom) & ~occupied & board;
+        uint64_t win = threats[player] & playable;
+        if (win != 0) {
+            dropWith<Geometry>(pos, player, __builtin_ctzll(win) / rows);
+            return player;
+        }
+        uint64_t block = threats[1 - player] & playable;
+        col = (block != 0) ? __builtin_ctzll(block) / rows : randomLegalWith<Geometry>(pos, rng);
+        dropWith<Geometry>(pos, player, col);
+        threats[player] = winningCellsOf<Geometry>(pos, pos.stones[player]);
+        player = 1 - player;
+    }
+    return -1;
+}
+
+// rolloutWith of the geometry chosen for the board by initShape
+int rollout(Position& pos, int player, Rng& rng, bool tactical) {
+    return pos.shape->rolloutKernel(pos, player, rng, tactical);
+}
+
+// this function plays count uniformly random playouts from pos, ROLLOUT_LANES boards at a time in lockstep
+// a lane holds one board as two masks, the discs of the side to move and of the side that just moved;
+// every step drops one disc on each lane and tests all lanes for a win at once (see checkLanes)
+// a disc needs no column heights: it goes to the lowest empty cell below the random top cell of a column
+// a finished lane starts over from pos until count playouts have been started
+// tactical: a lane plays its winning cell or blocks the opponent's before it picks a random column
+//           (see tacticalRolloutWith), with the winning cells of both sides kept per lane
+// player is the side to move; the results are added to playouts
+template <class Geometry>
+void rolloutBatchWith(const Position& pos, int player, Rng& rng, int count, Playouts& playouts, bool tactical) {
+    static_assert(ROLLOUT_LANES % 4 == 0, "the lanes fill whole AVX2 registers");
+    int rows = Geometry::rows(pos);
+    int cells = rows * Geometry::columns(pos);
+    uint64_t board = (cells == MAX_CELLS) ? ~0ULL : (1ULL << cells) - 1;
+    uint64_t top = 0;   // the top cell of every column
+    uint64_t bottom = 0;
+    for (int c = 0; c < Geometry::columns(pos); c++) {
+        top |= 1ULL << (c*rows + rows - 1);
+        bottom |= 1ULL << (c*rows);
+    }
+    alignas(32) uint64_t own[ROLLOUT_LANES];    // discs of the side to move
+    alignas(32) uint64_t other[ROLLOUT_LANES];  // discs of the side that just moved
+    alignas(32) uint64_t wins[ROLLOUT_LANES];   // nonzero if other contains connect in a row
+    uint64_t ownThreats[ROLLOUT_LANES];         // tactical: winning cells of own and other
+    uint64_t otherThreats[ROLLOUT_LANES];
+    int mover[ROLLOUT_LANES];                   // the side that just moved
+    bool live[ROLLOUT_LANES];
+    int started = 0;
+    int running = 0;
+    uint64_t threats[2] = {0, 0};               // tactical: winning cells of the side to move and the other in pos
+    if (tactical) {
+        threats[0] = winningCellsOf<Geometry>(pos, pos.stones[player]);
+        threats[1] = winningCellsOf<Geometry>(pos, pos.stones[1 - player]);
+    }
+    
+    for (int l = 0; l < ROLLOUT_LANES; l++) {
+        own[l] = pos.stones[player];
+        other[l] = pos.stones[1 - player];
+        ownThreats[l] = threats[0];
+        otherThreats[l] = threats[1];
+        mover[l] = 1 - player;
+        live[l] = started < count;
+        if (live[l]) started++, running++;
+    }
+    while (running > 0) {
+        for (int l = 0; l < ROLLOUT_LANES; l++) {
+            if (!live[l]) continue;
+            uint64_t empty = board & ~(own[l] | other[l]);
+            uint64_t open = empty & top;   // a live board is never full
+            uint64_t cell = 0;
+            if (tactical) {
+                uint64_t playable = (((own[l] | other[l]) << 1) | bottom) & empty;
+                uint64_t forced = ownThreats[l] & playable;
+                if (forced == 0) forced = otherThreats[l] & playable;
+                cell = forced & (0 - forced);
+            }
+            if (cell == 0) {
+#ifdef __BMI2__
+                cell = _pdep_u64(1ULL << randomBelow(rng, __builtin_popcountll(open)), open);
+#else
+                // without a popcount instruction, draw columns until one has space (as uniform over the open ones)
+                do {
+                    cell = 1ULL << (randomBelow(rng, Geometry::columns(pos))*rows + rows - 1);
+                } while ((cell & open) == 0);
+#endif
+                // the cells of the column from its top cell down (wrapping for the last column of a full mask)
+                uint64_t column = ((cell << 1) - (cell >> (rows - 1))) & empty;
+                cell = column & (0 - column);
+            }
+            uint64_t moved = own[l] | cell;
+            if (tactical) {
+                // a move wins exactly when it fills a winning cell, so the lanes need no check
+                wins[l] = cell & ownThreats[l];
+                ownThreats[l] = otherThreats[l];
+                otherThreats[l] = winningCellsOf<Geometry>(pos, moved);
+            }
+            own[l] = other[l];
+            other[l] = moved;
+            mover[l] ^= 1;
+        }
+        if (!tactical) checkLanes<Geometry>(pos, other, wins);
+        for (int l = 0; l < ROLLOUT_LANES; l++) {
+            if (!live[l] || (wins[l] == 0 && (own[l] | other[l]) != board)) continue;
+            if (wins[l] != 0) playouts.wins[mover[l]]++; else playouts.draws++;
+            if (playouts.amaf) {
+                addAmaf(playouts, mover[l] ? own[l] : other[l], mover[l] ? other[l] : own[l], wins[l] != 0 ? mover[l] : -1, 1);
+            }
+            if (started < count) {
+                own[l] = pos.stones[player];
+                other[l] = pos.stones[1 - player];
+                ownThreats[l] = threats[0];
+                otherThreats[l] = threats[1];
+                mover[l] = 1 - player;
+                started++;
+            } else {
+                live[l] = false;
+                running--;
+            }
+        }
+    }
+}
+
+// this function applies the test of checkWith to the masks of all ROLLOUT_LANES lanes
+// wins[l] is nonzero if discs[l] contains connect in a row
+// AVX2 tests four lanes per instruction; otherwise the lanes are the inner loop, which compilers vectorize
+template <class Geometry>
+void checkLanes(const Position& pos, const uint64_t* discs, uint64_t* wins) {
+    int connect = Geometry::connect(pos);
+#ifdef __AVX2__
+    for (int l = 0; l < ROLLOUT_LANES; l += 4) {
+        __m256i m = _mm256_load_si256((const __m256i*) &discs[l]);
+        __m256i found = _mm256_setzero_si256();
+        for (int d = 0; d < 4; d++) {
+            uint64_t start = Geometry::winStart(pos, d);
+            if (start == 0) continue;
+            int s = Geometry::shift(pos, d);
+            __m256i runs = m;
+            int length = 1;
+            while (2*length <= connect) {
+                runs = _mm256_and_si256(runs, _mm256_srl_epi64(runs, _mm_cvtsi32_si128(length*s)));
+                length *= 2;
+            }
+            if (length < connect) {
+                runs = _mm256_and_si256(runs, _mm256_srl_epi64(runs, _mm_cvtsi32_si128((connect - length)*s)));
+            }
+            found = _mm256_or_si256(found, _mm256_and_si256(runs, _mm256_set1_epi64x((long long) start)));
+        }
+        _mm256_store_si256((__m256i*) &wins[l], found);
+    }
+#else
+    for (int l = 0; l < ROLLOUT_LANES; l++) wins[l] = 0;
+    for (int d = 0; d < 4; d++) {
+        uint64_t start = Geometry::winStart(pos, d);
+        if (start == 0) continue;
+        int s = Geometry::shift(pos, d);
+        for (int l = 0; l < ROLLOUT_LANES; l++) {
+            uint64_t runs = discs[l];
+            int length = 1;
+            while (2*length <= connect) {
+                runs &= runs >> (length*s);
+                length *= 2;
+            }
+            if (length < connect) {
+                runs &= runs >> ((connect - length)*s);
+            }
+            wins[l] |= runs & start;
+        }
+    }
+#endif
+}
+
+// rolloutBatchWith of the geometry chosen for the board by initShape
+void rolloutBatch(const Position& pos, int player, Rng& rng, int count, Playouts& playouts, bool tactical) {
+    pos.shape->rolloutBatchKernel(pos, player, rng, count, playouts, tactical);
+}
+
+// this function adds count playouts that ended with the discs o and x to the AMAF tallies of playouts
+// a disc counts for every node of the path where its cell was still empty (see backPropagate)
+// winner is 0/1 or -1 for a draw
+void addAmaf(Playouts& playouts, uint64_t o, uint64_t x, int winner, uint32_t count) {
+    uint64_t discs[2] = {o, x};
+    for (int p = 0; p < 2; p++) {
+        uint32_t points = count * ((winner == p) ? 2 : (winner == -1) ? 1 : 0);
+        for (uint64_t m = discs[p]; m != 0; m &= m - 1) {
+            int cell = __builtin_ctzll(m);
+            playouts.amafVisits[p][cell] += count;
+            playouts.amafPoints[p][cell] += points;
+        }
+    }
+}
+
+// this function back-propagates the playout results from the leaf node to the root
+// every node on the path counts a visit per playout; the node's player scores 2 points for a win and 1 for a draw
+// virtualLoss > 0: the tree is shared, virtualLoss visits were already added during selection and the
+//                  statistics are updated atomically
+// RAVE (playouts.amaf): the children of every node on the path also count the playouts that ended with a disc
+//                       of their player on their cell, dropped anywhere below the node (in the tree or the playout)
+// a proven leaf proves its ancestors (see proveNode) for as long as they can be settled; with a table
+// (playouts.table) the ancestors it proves are stored for the transpositions of their positions
+// returns the depth of the leaf below the root
+int backPropagate(NodePool& pool, uint32_t leaf, const Playouts& playouts, int virtualLoss) {
+    int depth = -1;
+    uint32_t visits = playouts.wins[0] + playouts.wins[1] + playouts.draws;
+    bool shared = virtualLoss > 0;
+    bool proving = (shared ? __atomic_load_n(&pool.nodes[leaf].proof, __ATOMIC_RELAXED) : pool.nodes[leaf].proof) != unproven;
+    for (uint32_t i = leaf; i != NO_NODE; i = pool.nodes[i].parent) {
+        depth++;
+        Node& n = pool.nodes[i];
+        if (proving && i != leaf) {
+            proving = proveNode(pool, i, shared);
+            if (proving && playouts.table != nullptr && depth <= playouts.length) {
+                int proof = shared ? __atomic_load_n(&n.proof, __ATOMIC_RELAXED) : n.proof;
+                uint32_t work = shared ? __atomic_load_n(&n.visits, __ATOMIC_RELAXED) : n.visits;
+                storeProof(*playouts.table, playouts.keys[playouts.length - depth], proof, pool.root, work);
+            }
+        }
+        uint32_t points = 2*playouts.wins[n.player] + playouts.draws;
+        if (virtualLoss > 0) {
+            __atomic_fetch_add(&n.score, points, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&n.visits, visits - virtualLoss, __ATOMIC_RELAXED);  // wraps when it removes visits
+        } else {
+            n.visits += visits;
+            n.score += points;
+        }
+        if (!playouts.amaf) continue;
+        uint32_t first = (virtualLoss > 0) ? __atomic_load_n(&n.firstChild, __ATOMIC_ACQUIRE) : n.firstChild;
+        if (first != NO_NODE && first != EXPANDING) {
+            for (uint32_t k = first; k < first + n.childCount; k++) {
+                Node& child = pool.nodes[k];
+                uint32_t amafVisits = playouts.amafVisits[child.player][child.cell];
+                uint32_t amafPoints = playouts.amafPoints[child.player][child.cell];
+                if (virtualLoss > 0) {
+                    __atomic_fetch_add(&child.amafScore, amafPoints, __ATOMIC_RELAXED);
+                    __atomic_fetch_add(&child.amafVisits, amafVisits, __ATOMIC_RELAXED);
+                } else {
+                    child.amafScore += amafPoints;
+                    child.amafVisits += amafVisits;
+                }
+            }
+        }
+    }
+    return depth;
+}
+
+// this function implements the alpha-beta solver mode
+// iterative deepening negamax with alpha-beta pruning, center-first move ordering and a transposition table
+// deepens until the position is solved or the time or node budget of config runs out
+// with config.parallel set, config.threads - 1 helper threads search the same position on the same table
+// (Lazy SMP, see lazySearch); their results only reach this thread through the table
+// stats receives the nodes of all threads, the depth and the score of the deepest finished iteration
+// returns the best column number of the deepest finished iteration
+int alphaBeta(Position& pos1, const SearchConfig& config, TranspositionTable& table, SearchStats& stats) {
+    Position pos = pos1;
+    Budget budget;
+    startBudget(budget, config);
+    newSearch(table);
+    int threads = (config.parallel == sequential) ? 1 : config.threads;
+    std::vector<Solver> solvers(threads);
+    for (int t = 0; t < threads; t++) {
+        solvers[t].table = &table;
+        solvers[t].budget = &budget;
+        solvers[t].rootMoves = pos.moves;
+    }
+    Solver& solver = solvers[0];
+    int player = sideToMove(pos);
+    int cells = pos.shape->rows * pos.shape->columns;
+    int moves = pos.moves;
+    int choice = 0;
+    int best = 0;
+    int depth;
+    
+    for (int i = 0; i < pos.shape->columns && choice == 0; i++) {
+        if (canDrop(pos, pos.shape->order[i])) choice = pos.shape->order[i] + 1;
+    }
+    
+    std::vector<std::thread> helpers;
+    for (int t = 1; t < threads; t++) {
+        // the thread gets its own copy of pos, made before this thread starts dropping discs into it
+        helpers.push_back(std::thread(lazySearch, std::ref(solvers[t]), pos, t));
+    }
+    for (depth = 1; depth <= cells - moves; depth++) {
+        int score = negamax(solver, pos, player, depth, -MATE, MATE);
+        if (solver.stopped) break;
+        best = score;
+        if (solver.bestMove >= 0) choice = solver.bestMove + 1;
+        // a win or loss is proven, deeper iterations cannot change it
+        if (best > MATE - cells - 1 || best < -(MATE - cells - 1)) break;
+    }
+    budget.stopped = true;
+    for (int t = 0; t < helpers.size(); t++) {
+        helpers[t].join();
+    }
+    
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - budget.start).count();
+    unsigned long nodes = 0;
+    for (int t = 0; t < threads; t++) {
+        nodes += solvers[t].nodes;
+        stats.probes += solvers[t].probes;
+        stats.hits += solvers[t].hits;
+    }
+    stats.nodes = nodes;
+    stats.depth = (depth > cells - moves) ? cells - moves : depth - (solver.stopped ? 1 : 0);
+    stats.iterations = stats.depth;
+    stats.score = best;
+    stats.memory = (table.mask + 1) * sizeof(TTBucket);
+    stats.searchMs = elapsed;
+    stats.rate = nodes * 1000.0 / std::max(elapsed, 1e-3);
+    if (config.verbose) {
+        cout << "Alpha-Beta Solver Mode: " << endl;
+        cout << "Depth: " << stats.depth << " | Nodes: " << nodes << " | Table Hits: " << setprecision(3)
+             << 100.0 * stats.hits / std::max(stats.probes, 1UL) << "% | Score: " << best;
+        if (best > MATE - cells - 1) {
+            cout << " (win with disc " << MATE - best << ")";
+        } else if (best < -(MATE - cells - 1)) {
+            cout << " (loss with disc " << MATE + best << ")";
+        } else if (depth > cells - moves) {
+            cout << " (draw)";
+        }
+        cout << endl;
+    }
+    
+    return choice;
+}
+
+// this function is the body of a Lazy SMP helper thread of alphaBeta
+// it deepens on its own copy of root until the budget is stopped; odd helpers search one ply deeper than even
+// ones, so that the threads spread over the depths and fill the shared table ahead of the main thread
+void lazySearch(Solver& solver, const Position& root, int helper) {
+    Position pos = root;
+    int cells = pos.shape->rows * pos.shape->columns;
+    for (int depth = 1 + helper % 2; depth <= cells - pos.moves && !solver.stopped; depth++) {
+        negamax(solver, pos, sideToMove(pos), depth, -MATE, MATE);
+    }
+}
+
+// this function searches the position to the given depth with alpha-beta pruning
+// player is the side to move; returns the score from player's point of view
+// the budget is checked every 1024 nodes, solver.stopped is set once it has run out
+// at the root (solver.rootMoves discs) the table gives no cut-off, and the best column goes to solver.bestMove
+int negamax(Solver& solver, Position& pos, int player, int depth, int alpha, int beta) {
+    const Shape& shape = *pos.shape;
+    int moves = pos.moves;
+    int cells = shape.rows * shape.columns;
+    int alphaOrig = alpha;
+    int bestMove = -1;
+    int bestScore = -MATE;
+    int score;
+    unsigned long nodes = solver.nodes;   // the nodes below this one are the visits of its entry
+    bool root = moves == solver.rootMoves;
+    
+    if ((solver.nodes++ & 1023) == 0 && claimNodes(*solver.budget, 1024) == 0) {
+        solver.stopped = true;
+    }
+    if (solver.stopped) return 0;
+    if (moves == cells) return 0;
+    
+    // an immediate win ends the search of this node, at any depth (it is found again faster than in the table)
+    // the table holds a position and its mirror image in one entry, the moves in the canonical orientation
+    uint64_t key = canonicalKey(pos);
+    TTEntry entry;
+    for (int c = 0; c < shape.columns; c++) {
+        if (!canDrop(pos, c)) continue;
+        drop(pos, player, c);
+        State st = check(pos, player);
+        undo(pos, player, c);
+        if (st == won) {
+            if (root) solver.bestMove = c;
+            return MATE - (moves + 1);
+        }
+    }
+    if (depth == 0) return evaluate(pos, player);
+    
+    // without an immediate win, the earliest win is our disc after next
+    int maxScore = MATE - (moves + 3);
+    if (beta > maxScore) {
+        beta = maxScore;
+        if (alpha >= beta) return beta;
+    }
+    
+    // transposition table cut-off and best move from an earlier search
+    solver.probes++;
+    if (probeTable(*solver.table, key, entry)) {
+        solver.hits++;
+        if (entry.depth >= depth && !root) {
+            if (entry.flag == exact) return entry.score;
+            if (entry.flag == lower && entry.score > alpha) alpha = entry.score;
+            if (entry.flag == upper && entry.score < beta) beta = entry.score;
+            if (alpha >= beta) return entry.score;
+        }
+        if (entry.move >= 0) bestMove = canonicalColumn(pos, entry.move);
+    }
+    
+    // the table move first, then the columns from the center outwards
+    int order[MAX_COLUMNS + 1];
+    int count = 0;
+    if (bestMove >= 0 && canDrop(pos, bestMove)) order[count++] = bestMove;
+    for (int i = 0; i < shape.columns; i++) {
+        if (shape.order[i] != bestMove && canDrop(pos, shape.order[i])) order[count++] = shape.order[i];
+    }
+    
+    for (int i = 0; i < count; i++) {
+        drop(pos, player, order[i]);
+        score = -negamax(solver, pos, 1 - player, depth - 1, -beta, -alpha);
+        undo(pos, player, order[i]);
+        if (solver.stopped) return 0;
+        if (score > bestScore) {
+            bestScore = score;
+            bestMove = order[i];
+        }
+        if (score > alpha) alpha = score;
+        if (alpha >= beta) break;
+    }
+    
+    int flag = (bestScore <= alphaOrig) ? upper : (bestScore >= beta) ? lower : exact;
+    storeTable(*solver.table, key, bestScore, depth, flag, canonicalColumn(pos, bestMove), solver.nodes - nodes);
+    if (root) solver.bestMove = bestMove;
+    return bestScore;
+}
+
+// this function estimates an unsolved position from player's point of view
+// counts the empty cells that would complete a line for either player (threats)
+// the score stays far below the win and loss scores
+int evaluate(const Position& pos, int player) {
+    uint64_t empty = ~(pos.stones[0] | pos.stones[1]);
+    int mine = __builtin_popcountll(winningCells(pos, player) & empty);
+    int theirs = __builtin_popcountll(winningCells(pos, 1 - player) & empty);
+    return 2 * (mine - theirs);
+}
+
+// this function allocates the transposition table with the largest power-of-two bucket count within megabytes
+// the buckets start on a cache line boundary, so every bucket fills exactly one line
+// replacement is the policy of storeTable for the life of the table
+void resizeTable(TranspositionTable& table, unsigned long megabytes, Replacement replacement) {
+    uint64_t count = 1;
+    while (count * 2 * sizeof(TTBucket) <= megabytes * 1024 * 1024) count *= 2;
+    table.memory.assign(count * sizeof(TTBucket) + alignof(TTBucket) - 1, 0);
+    table.offset = (alignof(TTBucket) - (uintptr_t) table.memory.data() % alignof(TTBucket)) % alignof(TTBucket);
+    table.mask = count - 1;
+    table.generation = 0;
+    table.replacement = replacement;
+}
+
+// returns the first bucket of the table
+TTBucket* tableBuckets(TranspositionTable& table) {
+    return (TTBucket*) (table.memory.data() + table.offset);
+}
+
+// this function starts a new search on the table: the entries written so far age by one search
+// searches running at the same time on one table (see makeBook) may share a generation
+void newSearch(TranspositionTable& table) {
+    __atomic_fetch_add(&table.generation, 1, __ATOMIC_RELAXED);
+}
+
+// this function packs the fields of an entry into the data word of a TTSlot
+// bits 0-15 score, 16-23 depth, 24-25 flag, 26-30 move + 1, 31-36 generation, 37-63 visits
+uint64_t packEntry(int score, int depth, int flag, int move, int generation, unsigned long visits) {
+    return (uint64_t) (uint16_t) score | (uint64_t) depth << 16 | (uint64_t) flag << 24 | (uint64_t) (move + 1) << 26
+           | (uint64_t) generation << 31 | (uint64_t) std::min(visits, (1UL << 27) - 1) << 37;
+}
+
+// this function looks the position with key up in its bucket
+// several threads may probe and store at the same time (see TTSlot)
+// returns true and fills entry if the table holds the position
+bool probeTable(TranspositionTable& table, uint64_t key, TTEntry& entry) {
+    TTSlot* slots = tableBuckets(table)[key & table.mask].slots;
+    for (int i = 0; i < TT_SLOTS; i++) {
+        uint64_t data = __atomic_load_n(&slots[i].data, __ATOMIC_RELAXED);
+        uint64_t check = __atomic_load_n(&slots[i].check, __ATOMIC_RELAXED);
+        if ((check ^ data) != key || ((data >> 16) & 0xFF) == 0) continue;
+        entry.key = key;
+        entry.score = (int16_t) data;
+        entry.depth = (data >> 16) & 0xFF;
+        entry.flag = (data >> 24) & 3;
+        entry.move = (int) ((data >> 26) & 31) - 1;
+        entry.generation = (data >> 31) & 63;
+        entry.visits = data >> 37;
+        return true;
+    }
+    return false;
+}
+
+// this function writes the result of a search of the position with key into its bucket
+// the slot that holds the position already is overwritten, else the one table.replacement gives up
+// depth must be at least 1; move is -1 when there is none
+void storeTable(TranspositionTable& table, uint64_t key, int score, int depth, int flag, int move, unsigned long visits) {
+    TTSlot* slots = tableBuckets(table)[key & table.mask].slots;
+    int generation = __atomic_load_n(&table.generation, __ATOMIC_RELAXED) & 63;
+    int victim = (key >> 62) & (TT_SLOTS - 1);
+    int lowest = std::numeric_limits<int>::max();
+    for (int i = 0; i < TT_SLOTS; i++) {
+        uint64_t data = __atomic_load_n(&slots[i].data, __ATOMIC_RELAXED);
+        uint64_t check = __atomic_load_n(&slots[i].check, __ATOMIC_RELAXED);
+        if ((check ^ data) == key) {
+            victim = i;
+            break;
+        }
+        if (table.replacement == replaceAlways) continue;
+        int slotDepth = (data >> 16) & 0xFF;
+        int age = (generation - (int) ((data >> 31) & 63)) & 63;
+        int worth = (table.replacement == replaceDepth) ? slotDepth : 64 - __builtin_clzll((data >> 37) | 1);
+        if (slotDepth == 0) worth = std::numeric_limits<int>::min() / 2;  // an empty slot
+        if (worth - 8 * age < lowest) {
+            lowest = worth - 8 * age;
+            victim = i;
+        }
+    }
+    uint64_t data = packEntry(score, depth, flag, move, generation, visits);
+    __atomic_store_n(&slots[victim].data, data, __ATOMIC_RELAXED);
+    __atomic_store_n(&slots[victim].check, key ^ data, __ATOMIC_RELAXED);
+}
+
+// determines the computer's choice and human's choice based on the current position
 // the next move is the computer's move
 // choices = [computerChoice, humanChoice]
-std::vector<int> determineComputerChoice(std::vector<std::vector<int> >& grid) {
+std::vector<int> determineComputerChoice(const Position& pos) {
     int computerChoice = 0;    // 'o': choice = 0; 'x': choice = 1;
     int humanChoice = 1;       // the choice of the human player
-    int xcount = 0;
-    int ocount = 0;
     std::vector<int> choices(2);
     
-    // determine the computer's symbol from the current grid
-    // the computer is x if for the current grid, x's = o's
-    // the computer is o if for the current grid, x's > o's
-    for (int i = 0; i < grid.size(); i++) {
-        for (int j = 0; j < grid[0].size(); j++) {
-            if (grid[i][j] == 0) {
-                ocount++;
-            } else if (grid[i][j] == 1) {
-                xcount++;
-            }
-        }
-    }
-    if (xcount == ocount) {
+    // determine the computer's symbol from the move counter
+    // the computer is x if for the current position, x's = o's
+    // the computer is o if for the current position, x's > o's
+    if (sideToMove(pos) == 1) {
         computerChoice = 1;
         humanChoice = 0;
     }
@@ -18,9 +18,30 @@
 #include <iomanip>
 #include <vector>
 #include <fstream>
+#include <sstream>
 #include <cstring>
 #include <algorithm>
 #include <limits>
 #include <memory>
+#include <functional>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <poll.h>
+#if defined(__BMI2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #endif /* Connect4_hpp */